@@ -0,0 +1,142 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <quant/quant.h>
+
+
+// reference decoder for the server IDs in QUIC-LB CIDs, for testing and for
+// building stateless load balancers
+
+
+static void usage(const char * const name)
+{
+    printf("%s [options] [cid...]\n", name);
+    printf("\t -s len\t\tserver ID length\n");
+    printf("\t -n len\t\tnonce length\n");
+    printf("\t[-k key]\t16-byte AES key in hex; default is plaintext mode\n");
+    printf("\t[-r cr]\t\tconfig rotation codepoint; default 0\n");
+    printf("\t[-h]\t\tthis help\n");
+    printf("Reads hex CIDs from stdin if none are given, and prints the "
+           "server ID of each, or \"-\" if the CID is not routable.\n");
+}
+
+
+static size_t hex2bin(const char * const hex, uint8_t * const bin, size_t len)
+{
+    size_t n = 0;
+    for (const char * h = hex; h[0] && h[1] && n < len; h += 2) {
+        char byte[3] = {h[0], h[1], 0};
+        char * end;
+        bin[n++] = (uint8_t)strtoul(byte, &end, 16);
+        if (*end)
+            return 0;
+    }
+    return n;
+}
+
+
+static void decode(const struct q_lb * const lb,
+                   const uint8_t sid_len,
+                   const char * const hex)
+{
+    uint8_t cid[20];
+    uint8_t sid[15];
+    const size_t cid_len = hex2bin(hex, cid, sizeof(cid));
+    printf("%s ", hex);
+    if (cid_len && q_lb_sid(lb, cid, cid_len, sid)) {
+        for (uint8_t i = 0; i < sid_len; i++)
+            printf("%02x", sid[i]);
+        printf("\n");
+    } else
+        printf("-\n");
+}
+
+
+int main(int argc, char * argv[])
+{
+    uint8_t key[16];
+    struct q_lb_conf conf = {0};
+    int ch;
+    while ((ch = getopt(argc, argv, "hs:n:k:r:")) != -1) {
+        switch (ch) {
+        case 's':
+            conf.sid_len = (uint8_t)strtoul(optarg, 0, 10);
+            break;
+        case 'n':
+            conf.nonce_len = (uint8_t)strtoul(optarg, 0, 10);
+            break;
+        case 'k':
+            if (strlen(optarg) != 2 * sizeof(key) ||
+                hex2bin(optarg, key, sizeof(key)) != sizeof(key)) {
+                fprintf(stderr, "key must be %zu hex bytes\n", sizeof(key));
+                return 1;
+            }
+            conf.key = key;
+            break;
+        case 'r':
+            conf.cr = (uint8_t)strtoul(optarg, 0, 10);
+            break;
+        case 'h':
+        case '?':
+        default:
+            usage(basename(argv[0]));
+            return 0;
+        }
+    }
+
+    if (conf.sid_len == 0 || conf.sid_len > sizeof(conf.sid)) {
+        usage(basename(argv[0]));
+        return 1;
+    }
+
+    struct q_lb * const lb = q_lb_new(&conf);
+    if (lb == 0)
+        return 1;
+
+    if (optind < argc)
+        for (int i = optind; i < argc; i++)
+            decode(lb, conf.sid_len, argv[i]);
+    else {
+        char line[2 * 20 + 2];
+        while (fgets(line, sizeof(line), stdin)) {
+            line[strcspn(line, "\r\n")] = 0;
+            if (*line)
+                decode(lb, conf.sid_len, line);
+        }
+    }
+
+    q_lb_free(lb);
+    return 0;
+}
@@ -0,0 +1,371 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+// Convert the binary qlog files written by the library into one draft-01 JSON
+// qlog file per connection.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+#include "qlog.h"
+#include "qlog_bin.h"
+
+
+struct trace {
+    FILE * f;
+    uint64_t last_t;
+};
+
+static struct trace * traces;
+static uint32_t traces_len;
+static const char * out_dir;
+
+
+static void usage(const char * const name)
+{
+    printf("%s [options] file.qlb...\n", name);
+    printf("\t[-d dir]\twrite JSON qlog files to this directory; default is "
+           "the directory of each input file\n");
+    printf("\t[-h]\t\tthis help\n");
+}
+
+
+static struct trace * get_trace(const uint32_t id)
+{
+    if (id >= traces_len) {
+        const uint32_t len = MAX(id + 1, traces_len * 2);
+        traces = realloc(traces, len * sizeof(*traces));
+        if (traces == 0) {
+            perror("realloc");
+            exit(1);
+        }
+        memset(&traces[traces_len], 0,
+               (len - traces_len) * sizeof(*traces));
+        traces_len = len;
+    }
+    return &traces[id];
+}
+
+
+static void close_trace(struct trace * const t)
+{
+    if (t->f) {
+        fputs("]}]}", t->f);
+        fclose(t->f);
+    }
+    t->f = 0;
+    t->last_t = 0;
+}
+
+
+static void open_trace(struct trace * const t,
+                       const char * const dir,
+                       const char * const producer,
+                       const uint8_t * const pos)
+{
+    struct qlog_rec_open o;
+    memcpy(&o, pos, sizeof(o));
+    const char * const name = (const char *)pos + sizeof(o);
+    const char * const gid = name + o.name_len;
+
+    // a restart (during vneg) starts the trace over
+    close_trace(t);
+
+    char file[MAXPATHLEN];
+    snprintf(file, sizeof(file), "%s/%.*s.qlog", dir, o.name_len, name);
+    t->f = fopen(file, "we");
+    if (t->f == 0) {
+        fprintf(stderr, "could not fopen %s: %s\n", file, strerror(errno));
+        return;
+    }
+
+    fprintf(t->f,
+            "{\"qlog_version\":\"draft-01\",\"title\":\"%s "
+            "qlog\",\"traces\":[{\"vantage_point\":{\"type\":\"%s\"},"
+            "\"configuration\":{\"time_units\":\"us\"},\"common_fields\":{"
+            "\"group_id\":\"%.*s\",\"protocol_type\":\"QUIC_HTTP3\"},\"event_"
+            "fields\":[\"delta_time\",\"category\","
+            "\"event\",\"trigger\",\"data\"],\"events\":[",
+            producer, o.is_clnt ? "client" : "server", o.gid_len, gid);
+}
+
+
+static void common(struct trace * const t, const struct qlog_rec * const r)
+{
+    fprintf(t->f, "%s[%" PRIu64, t->last_t ? "," : "",
+            (r->t - t->last_t) / 1000);
+    t->last_t = r->t;
+}
+
+
+// a corrupt or newer file may carry event numbers we have no name for
+#define evt_name(tbl, evt)                                                     \
+    ((evt) < sizeof(tbl) / sizeof((tbl)[0]) && (tbl)[(evt)] ? (tbl)[(evt)]     \
+                                                             : "unknown")
+
+
+static void transport(struct trace * const t,
+                      const struct qlog_rec * const r,
+                      const char * const trg,
+                      const uint8_t * const pos)
+{
+    static const char * const evt_str[] = {[pkt_tx] = "packet_sent",
+                                           [pkt_rx] = "packet_received",
+                                           [pkt_dp] = "packet_dropped"};
+    static const char * const typ_str[] = {
+        [qp_vneg] = "version_negotiation",
+        [qp_init] = "initial",
+        [qp_rtry] = "retry",
+        [qp_hshk] = "handshake",
+        [qp_0rtt] = "zerortt",
+        [qp_1rtt] = "onertt",
+        [qp_unknown] = "unknown"};
+
+    struct qlog_rec_pkt p;
+    memcpy(&p, pos, sizeof(p));
+
+    fprintf(t->f,
+            ",\"transport\",\"%s\",\"%.*s\",{\"packet_type\":\"%s\",\"header\":"
+            "{\"packet_size\":%u",
+            evt_name(evt_str, r->evt), r->trg_len, trg,
+            typ_str[MIN(p.pkt_type, qp_unknown)], p.udp_len);
+    if (p.has_nr)
+        fprintf(t->f, ",\"packet_number\":%" PRIu64, p.nr);
+    fputs("}", t->f);
+
+    if (p.has_strm == false && p.has_ack == false)
+        goto done;
+
+    fputs(",\"frames\":[", t->f);
+    if (p.has_strm) {
+        fprintf(t->f,
+                "{\"frame_type\":\"stream\",\"stream_id\":%" PRId64
+                ",\"length\":%u,\"offset\":%" PRIu64,
+                p.sid, p.strm_len, p.strm_off);
+        if (p.fin)
+            fputs(",\"fin\":true", t->f);
+        fputs("}", t->f);
+    }
+
+    if (p.has_ack) {
+        fprintf(t->f,
+                "%s{\"frame_type\":\"ack\",\"ack_delay\":%" PRIu64
+                ",\"acked_ranges\":[",
+                p.has_strm ? "," : "", p.ack_delay);
+        const uint8_t * rng_pos = pos + sizeof(p);
+        for (uint8_t n = 0; n < p.ack_rng_cnt; n++) {
+            uint64_t rng[2];
+            memcpy(rng, rng_pos, sizeof(rng));
+            rng_pos += sizeof(rng);
+            fprintf(t->f, "%s[%" PRIu64 ",%" PRIu64 "]", n ? "," : "", rng[0],
+                    rng[1]);
+        }
+        fputs("]}", t->f);
+    }
+    fputs("]", t->f);
+
+done:
+    fputs("}]", t->f);
+}
+
+
+static void recovery(struct trace * const t,
+                     const struct qlog_rec * const r,
+                     const char * const trg,
+                     const uint8_t * const pos)
+{
+    static const char * const evt_str[] = {[rec_mu] = "metrics_updated",
+                                           [rec_pl] = "packet_lost"};
+
+    struct qlog_rec_rec m;
+    memcpy(&m, pos, sizeof(m));
+
+    fprintf(t->f, ",\"recovery\",\"%s\",\"%.*s\",{",
+            evt_name(evt_str, r->evt), r->trg_len, trg);
+
+    if (r->evt == rec_pl) {
+        if (m.loss_trigger == 3)
+            fputs("\"trigger\":\"pto_expired\"", t->f);
+        else {
+            fprintf(t->f, "\"packet_number\":%" PRIu64, m.nr);
+            if (m.loss_trigger == 1)
+                fputs(",\"trigger\":\"time_threshold\"", t->f);
+            if (m.loss_trigger == 2)
+                fputs(",\"trigger\":\"packet_threshold\"", t->f);
+        }
+        goto done;
+    }
+
+    static const struct {
+        uint8_t bit;
+        const char * name;
+    } metrics[] = {{QLOG_MU_IN_FLIGHT, "bytes_in_flight"},
+                   {QLOG_MU_CWND, "cwnd"},
+                   {QLOG_MU_SRTT, "smoothed_rtt"},
+                   {QLOG_MU_MIN_RTT, "min_rtt"},
+                   {QLOG_MU_LATEST_RTT, "latest_rtt"},
+                   {QLOG_MU_RTTVAR, "rtt_variance"}};
+    const uint64_t val[] = {m.in_flight,  m.cwnd,       m.srtt,
+                            m.min_rtt,    m.latest_rtt, m.rttvar};
+
+    bool prev_metric = false;
+    for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++)
+        if (m.changed & metrics[i].bit) {
+            fprintf(t->f, "%s\"%s\":%" PRIu64, prev_metric ? "," : "",
+                    metrics[i].name, val[i]);
+            prev_metric = true;
+        }
+
+done:
+    fputs("}]", t->f);
+}
+
+
+static void timers(struct trace * const t,
+                   const struct qlog_rec * const r,
+                   const char * const trg,
+                   const uint8_t * const pos)
+{
+    static const char * const evt_str[] = {[tim_ack] = "rack_timer",
+                                           [tim_prb] = "probe_timer"};
+
+    struct qlog_rec_tim tim;
+    memcpy(&tim, pos, sizeof(tim));
+    fprintf(t->f, ",\"recovery\",\"%s\",\"%.*s\",{\"timer\":%f}]",
+            evt_name(evt_str, r->evt), r->trg_len, trg, tim.timer);
+}
+
+
+static int convert(const char * const file)
+{
+    FILE * const in = fopen(file, "re");
+    if (in == 0) {
+        fprintf(stderr, "could not fopen %s: %s\n", file, strerror(errno));
+        return 1;
+    }
+
+    struct qlog_bin_hdr hdr;
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || hdr.magic != QLOG_BIN_MAGIC ||
+        hdr.vers != QLOG_BIN_VERS) {
+        fprintf(stderr, "%s is not a version %u binary qlog file\n", file,
+                QLOG_BIN_VERS);
+        fclose(in);
+        return 1;
+    }
+    hdr.producer[sizeof(hdr.producer) - 1] = 0;
+
+    char in_dir[MAXPATHLEN];
+    strncpy(in_dir, file, sizeof(in_dir) - 1);
+    in_dir[sizeof(in_dir) - 1] = 0;
+    const char * const dir = out_dir ? out_dir : dirname(in_dir);
+
+    int ret = 0;
+    uint8_t buf[UINT16_MAX];
+    struct qlog_rec r;
+    while (fread(&r, sizeof(r), 1, in) == 1) {
+        const size_t len = r.len - sizeof(r);
+        if (r.len < sizeof(r) || fread(buf, 1, len, in) != len) {
+            fprintf(stderr, "%s is truncated\n", file);
+            ret = 1;
+            break;
+        }
+
+        struct trace * const t = get_trace(r.id);
+        const char * const trg = (const char *)buf;
+        const uint8_t * const pos = buf + r.trg_len;
+
+        if (r.type == qr_open) {
+            open_trace(t, dir, hdr.producer, pos);
+            continue;
+        }
+        if (t->f == 0)
+            continue;
+
+        switch (r.type) {
+        case qr_close:
+            close_trace(t);
+            break;
+        case qr_transport:
+            common(t, &r);
+            transport(t, &r, trg, pos);
+            break;
+        case qr_recovery:
+            common(t, &r);
+            recovery(t, &r, trg, pos);
+            break;
+        case qr_timers:
+            common(t, &r);
+            timers(t, &r, trg, pos);
+            break;
+        default:
+            fprintf(stderr, "unknown record type %u in %s\n", r.type, file);
+        }
+    }
+
+    // terminate traces of conns that were still open when logging stopped
+    for (uint32_t i = 0; i < traces_len; i++)
+        close_trace(&traces[i]);
+    fclose(in);
+    return ret;
+}
+
+
+int main(int argc, char * argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "hd:")) != -1) {
+        switch (ch) {
+        case 'd':
+            out_dir = optarg;
+            break;
+        case 'h':
+        case '?':
+        default:
+            usage(basename(argv[0]));
+            return 0;
+        }
+    }
+
+    if (optind == argc) {
+        usage(basename(argv[0]));
+        return 1;
+    }
+
+    int ret = 0;
+    for (int i = optind; i < argc; i++)
+        ret |= convert(argv[i]);
+    free(traces);
+    return ret;
+}
@@ -30,6 +30,7 @@
 #include <inttypes.h>
 #include <libgen.h>
 #include <net/if.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -71,7 +72,11 @@ static void __attribute__((noreturn)) usage(const char * const name,
                                             const uint32_t timeout,
                                             const uint32_t initial_rtt,
                                             const bool retry,
-                                            const uint32_t num_bufs)
+                                            const uint32_t num_bufs,
+                                            const uint8_t workers,
+                                            const uint8_t sign_threads,
+                                            const char * const tckt_keys,
+                                            const char * const ocsp)
 {
     printf("%s [options]\n", name);
     printf("\t[-b bufs]\tnumber of network buffers to allocate; default %u\n ",
@@ -79,18 +84,27 @@ static void __attribute__((noreturn)) usage(const char * const name,
     printf("\t[-c cert]\tTLS certificate; default %s\n", cert);
     printf("\t[-d dir]\tserver root directory; default %s\n", dir);
     printf("\t[-i interface]\tinterface to run over; default %s\n", ifname);
+    printf("\t[-j threads]\tthreads for TLS signing; default %u (inline)\n",
+           sign_threads);
     printf("\t[-k key]\tTLS key; default %s\n", key);
     printf("\t[-l log]\tlog file for TLS keys; default %s\n",
            *tls_log ? tls_log : "false");
+    printf("\t[-o ocsp]\tOCSP response to staple; default %s\n",
+           *ocsp ? ocsp : "false");
     printf("\t[-p port]\tdestination port; default %d\n", port);
     printf("\t[-q log]\twrite qlog events to directory; default %s\n",
            *qlog_dir ? qlog_dir : "false");
     printf("\t[-r]\t\tforce a Retry; default %s\n", retry ? "true" : "false");
+    printf("\t[-s secret]\tfile with session ticket key secret; default %s\n",
+           *tckt_keys ? tckt_keys : "false");
     printf("\t[-t timeout]\tidle timeout in seconds; default %u\n", timeout);
 #ifndef NDEBUG
     printf("\t[-v verbosity]\tverbosity level (0-%d, default %d)\n", DLEVEL,
            util_dlevel);
 #endif
+    printf("\t[-w workers]\tprocesses sharing the ports (1-255), never "
+           "exiting when idle; default %u\n",
+           workers);
     printf("\t[-x rtt]\tinitial RTT in milliseconds (default %u)\n",
            initial_rtt);
     exit(0);
@@ -152,6 +166,41 @@ static uint32_t bench_cnt = 0;
 #endif
 
 
+struct obj_state {
+    uint32_t left; ///< Bytes of the "/n" object still to be generated.
+    uint8_t c;     ///< Fill character for the next buffer.
+    uint8_t _unused[3];
+};
+
+
+static uint32_t fill_obj(struct q_stream * const s __attribute__((unused)),
+                         uint8_t * const buf,
+                         const uint32_t max_len,
+                         bool * const fin,
+                         void * const arg)
+{
+    struct obj_state * const o = arg;
+    if (buf == 0) {
+        // the stream went away before we were done
+        free(o);
+        return 0;
+    }
+
+    const uint32_t len = MIN(o->left, max_len);
+#ifndef NDEBUG
+    // randomize data
+    memset(buf, o->c, len);
+    o->c = unlikely(o->c == 'Z') ? 'A' : o->c + 1;
+#endif
+    o->left -= len;
+    if (o->left == 0) {
+        *fin = true;
+        free(o);
+    }
+    return len;
+}
+
+
 static int serve_cb(http_parser * parser, const char * at, size_t len)
 {
     (void)parser;
@@ -190,24 +239,11 @@ static int serve_cb(http_parser * parser, const char * at, size_t len)
     // check if this is a "GET /n" request for random data
     const uint32_t n = (uint32_t)strtoul(&path[2], 0, 10);
     if (n) {
-        struct w_iov_sq out = w_iov_sq_initializer(out);
-        q_alloc(d->w, &out, d->c, d->af, n);
-        // check whether we managed to allow enough buffers
-        if (w_iov_sq_len(&out) != n) {
-            warn(ERR, "could only allocate %" PRIu "/%u bytes of buffer",
-                 w_iov_sq_len(&out), n);
-            q_free(&out);
-            return send_err(d, 500);
-        }
-
+        struct obj_state * const o = calloc(1, sizeof(*o));
+        ensure(o, "could not calloc");
+        o->left = n;
 #ifndef NDEBUG
-        // randomize data
-        struct w_iov * v;
-        uint8_t c = 'A' + (uint8_t)w_rand_uniform32(26);
-        sq_foreach (v, &out, next) {
-            memset(v->buf, c, v->len);
-            c = unlikely(c == 'Z') ? 'A' : c + 1;
-        }
+        o->c = 'A' + (uint8_t)w_rand_uniform32(26);
 
         // for the two "benchmark objects", reduce logging
         if (is_bench_obj(n)) {
@@ -217,8 +253,11 @@ static int serve_cb(http_parser * parser, const char * at, size_t len)
         }
 #endif
 
-        q_write(d->s, &out, true);
-
+        // generate the data only as the stream is able to TX it
+        if (q_write_fill(d->s, fill_obj, o) == false) {
+            free(o);
+            return send_err(d, 500);
+        }
         return 0;
     }
 
@@ -243,6 +282,8 @@ static int serve_cb(http_parser * parser, const char * at, size_t len)
     ensure(f != -1, "could not open %s", path);
 
     q_write_file(d->w, d->s, f, (uint32_t)info.st_size, true);
+    // the stream has its own mapping or descriptor now
+    close(f);
 
     return 0;
 }
@@ -260,8 +301,60 @@ strm_key(struct q_conn * const c, const struct q_stream * const s)
 }
 
 
+static volatile sig_atomic_t dump_stats = 0;
+
+
+static void on_sigusr1(int sig __attribute__((unused)))
+{
+    dump_stats = 1;
+}
+
+
+static void __attribute__((nonnull)) print_stats(struct w_engine * const w)
+{
+    static struct q_engine_stats st;
+    static char buf[16384];
+    q_engine_stats(w, &st);
+    const size_t len = q_stats_prometheus(&st, buf, sizeof(buf));
+    fwrite(buf, 1, MIN(len, sizeof(buf) - 1), stdout);
+    fflush(stdout);
+}
+
+
 #define MAXPORTS 16
 
+
+// Fork n - 1 workers, one after another, so that the sockets of worker i are
+// at index i in each SO_REUSEPORT group. Returns the index of the caller, and
+// for a child the pipe to signal its parent on once it has bound its sockets.
+// A worker that fails to bind exits without signaling, which stops the parent.
+//
+// When a socket closes, the kernel moves the last one in the group into its
+// slot, which re-steers that worker's short-header pkts to the wrong process.
+// Workers therefore don't exit on the idle timeout; if one dies, restart the
+// whole group.
+static uint8_t spawn_workers(const uint8_t n, int * const bound_fd)
+{
+    *bound_fd = -1;
+    for (uint8_t i = 0; i < n - 1; i++) {
+        int fds[2];
+        ensure(pipe(fds) == 0, "pipe");
+        const pid_t pid = fork();
+        ensure(pid != -1, "fork");
+        if (pid == 0) {
+            close(fds[0]);
+            *bound_fd = fds[1];
+            return i;
+        }
+        close(fds[1]);
+        char x;
+        ensure(read(fds[0], &x, sizeof(x)) == sizeof(x),
+               "worker %u failed to bind", i);
+        close(fds[0]);
+    }
+    return n - 1;
+}
+
 int main(int argc, char * argv[])
 {
     uint32_t timeout = 10;
@@ -279,6 +372,8 @@ int main(int argc, char * argv[])
     char key[MAXPATHLEN] = "test/dummy.key";
     char tls_log[MAXPATHLEN] = "";
     char qlog_dir[MAXPATHLEN] = "";
+    char tckt_keys[MAXPATHLEN] = "";
+    char ocsp[MAXPATHLEN] = "";
     uint16_t port[MAXPORTS] = {4433, 4434};
     size_t num_ports = 0;
     uint32_t num_bufs = 100000;
@@ -286,6 +381,8 @@ int main(int argc, char * argv[])
     int ch;
     int ret = 0;
     bool retry = false;
+    uint8_t workers = 1;
+    uint8_t sign_threads = 0;
 
     // set default TLS log file from environment
     const char * const keylog = getenv("SSLKEYLOGFILE");
@@ -294,7 +391,8 @@ int main(int argc, char * argv[])
         tls_log[MAXPATHLEN - 1] = 0;
     }
 
-    while ((ch = getopt(argc, argv, "hi:p:d:v:c:k:t:b:q:rl:x:a:e:f:g")) != -1) {
+    while ((ch = getopt(argc, argv,
+                        "hi:p:d:v:c:k:t:b:q:rl:x:a:e:f:gw:j:s:o:")) != -1) {
         switch (ch) {
         case 'q':
             strncpy(qlog_dir, optarg, sizeof(qlog_dir) - 1);
@@ -345,6 +443,18 @@ int main(int argc, char * argv[])
         case 'l':
             strncpy(tls_log, optarg, sizeof(tls_log) - 1);
             break;
+        case 's':
+            strncpy(tckt_keys, optarg, sizeof(tckt_keys) - 1);
+            break;
+        case 'o':
+            strncpy(ocsp, optarg, sizeof(ocsp) - 1);
+            break;
+        case 'j':
+            sign_threads = (uint8_t)MIN(UINT8_MAX, strtoul(optarg, 0, 10));
+            break;
+        case 'w':
+            workers = (uint8_t)MAX(1, MIN(UINT8_MAX, strtoul(optarg, 0, 10)));
+            break;
         case 'v':
 #ifndef NDEBUG
             ini_dlevel = util_dlevel =
@@ -355,7 +465,8 @@ int main(int argc, char * argv[])
         case '?':
         default:
             usage(basename(argv[0]), ifname, qlog_dir, port[0], dir, cert, key,
-                  tls_log, timeout, initial_rtt, retry, num_bufs);
+                  tls_log, timeout, initial_rtt, retry, num_bufs, workers,
+                  sign_threads, tckt_keys, ocsp);
         }
     }
 
@@ -363,9 +474,24 @@ int main(int argc, char * argv[])
         // if no -p args were given, we listen on two ports by default
         num_ports = 2;
 
+#ifndef HAVE_W_REUSEPORT
+    if (workers > 1) {
+        warn(ERR, "%s built without SO_REUSEPORT support, cannot run workers",
+             basename(argv[0]));
+        return 1;
+    }
+#endif
+
     const int dir_fd = open(dir, O_RDONLY | O_CLOEXEC);
     ensure(dir_fd != -1, "%s does not exist", dir);
 
+    // with several workers, each one's server ID is its index, which the
+    // kernel uses to pick the worker for a short-header pkt
+    int bound_fd = -1;
+    const uint8_t worker =
+        workers > 1 ? spawn_workers(workers, &bound_fd) : 0;
+    const struct q_lb_conf lb = {.sid = {worker}, .sid_len = 1, .nonce_len = 7};
+
     struct w_engine * const w =
         q_init(ifname,
                &(const struct q_conf){
@@ -376,16 +502,23 @@ int main(int argc, char * argv[])
                                              .enable_udp_zero_checksums = true},
                    .qlog_dir = *qlog_dir ? qlog_dir : 0,
                    .tls_log = *tls_log ? tls_log : 0,
+                   .ticket_keys = *tckt_keys ? tckt_keys : 0,
                    .force_retry = retry,
+                   .enable_reuseport = workers > 1,
+                   .lb = workers > 1 ? &lb : 0,
                    .num_bufs = num_bufs,
+                   .tls_sign_threads = sign_threads,
                    .tls_cert = cert,
-                   .tls_key = key});
+                   .tls_key = key,
+                   .tls_ocsp = *ocsp ? ocsp : 0});
+    bool all_bound = true;
     for (size_t i = 0; i < num_ports; i++) {
         for (uint16_t idx = 0; idx < w->addr_cnt; idx++) {
-#ifndef NDEBUG
-            const struct q_conn * const c =
-#endif
-                q_bind(w, idx, port[i]);
+            const struct q_conn * const c = q_bind(w, idx, port[i]);
+            if (c == 0)
+                all_bound = false;
+            if (c && workers > 1 && worker == 0)
+                q_reuseport_steer(c, workers);
             warn(DBG, "%s %s %s %s%s%s:%d", basename(argv[0]),
                  c ? "listening on" : "failed to bind to", ifname,
                  w->ifaddr[idx].addr.af == AF_INET6 ? "[" : "",
@@ -393,6 +526,20 @@ int main(int argc, char * argv[])
                  w->ifaddr[idx].addr.af == AF_INET6 ? "]" : "", port[i]);
         }
     }
+    if (workers > 1 && all_bound == false) {
+        // a missing socket would shift the steering index of later workers
+        warn(ERR, "worker %u could not bind all sockets, exiting", worker);
+        q_cleanup(w);
+        return 1;
+    }
+    if (bound_fd != -1) {
+        // let the parent fork the next worker
+        ensure(write(bound_fd, "", 1) == 1, "write");
+        close(bound_fd);
+    }
+
+    // dump metrics in Prometheus format on SIGUSR1 (once q_ready() returns)
+    signal(SIGUSR1, on_sigusr1);
 
     khash_t(strm_cache) sc = {0};
     bool first_conn = true;
@@ -402,9 +549,14 @@ int main(int argc, char * argv[])
         struct q_conn * c;
         const bool have_active =
             q_ready(w, first_conn ? 0 : timeout * NS_PER_S, &c);
+        if (dump_stats) {
+            dump_stats = 0;
+            print_stats(w);
+        }
         // warn(ERR, "%u %u", first_conn, have_active);
         if (c == 0) {
-            if (have_active == false && timeout)
+            // with workers, an exit would re-steer the others' pkts
+            if (have_active == false && timeout && workers == 1)
                 break;
             continue;
         }
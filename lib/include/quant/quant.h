@@ -41,6 +41,7 @@ extern "C" {
 
 struct w_iov_sq;
 struct q_stream;
+struct q_lb;
 
 
 struct q_conn_conf {
@@ -57,6 +58,19 @@ struct q_conn_conf {
 };
 
 
+/// QUIC-LB style server ID encoding for server CIDs, see q_conf.lb. CIDs are
+/// 1 + sid_len + nonce_len bytes. With a key, server ID and nonce are
+/// encrypted as one AES-128 block, so they must add up to 16 bytes.
+struct q_lb_conf {
+    const uint8_t * key; ///< 16-byte AES-128 key, or zero for plaintext.
+    uint8_t sid[15];     ///< Server ID of this instance.
+    uint8_t sid_len;     ///< Server ID length (1-15).
+    uint8_t nonce_len;   ///< Nonce length (at least 4 for plaintext).
+    uint8_t cr;          ///< Config rotation codepoint (0-6).
+    uint8_t _unused[6];
+};
+
+
 struct q_conf {
     const struct q_conn_conf * const conn_conf;
     const char * const ticket_store; // ignored for server
@@ -66,11 +80,28 @@ struct q_conf {
     const char * const qlog_dir;
     uint32_t num_bufs;
     uint8_t enable_tls_cert_verify : 1;
-    uint8_t force_retry : 1;    // ignored on client
-    uint8_t force_chacha20 : 1; // TODO: is temporary
-    uint8_t : 5;
+    uint8_t force_retry : 1;      // ignored on client
+    uint8_t force_chacha20 : 1;   // TODO: is temporary
+    uint8_t enable_io_uring : 1;  // ignored unless built with liburing
+    uint8_t enable_cid_slots : 1; // index-encoded server CIDs, no hashing
+    uint8_t enable_reuseport : 1; // share server ports with other processes
+    uint8_t : 2;
     uint8_t client_cid_len;
     uint8_t server_cid_len;
+    uint8_t tls_sign_threads; // sign handshakes off the event loop (server)
+
+    const struct q_lb_conf * const lb; // server CIDs encode a server ID
+    const char * const ticket_keys;    // secret for ticket keys (server)
+    const char * const replay_file;    // share 0-RTT replay filter (server)
+    const char * const tls_ocsp;       // OCSP response to staple (server)
+
+    uint32_t retry_new_conns;    // Retry above this many new conns/sec
+    uint32_t retry_accept_queue; // Retry above this accept queue length
+    uint32_t max_hshks;          // refuse conns above this many handshakes
+    uint32_t max_new_conns;      // refuse conns above this many per second
+    uint32_t max_accept_queue;   // refuse conns above this accept queue len
+    uint32_t ticket_key_period;  // seconds between ticket key rotations
+    uint32_t max_tickets;        // ticket cache entries (client)
 };
 
 
@@ -102,6 +133,116 @@ struct q_conn_info {
 };
 
 
+#define Q_HIST_SUB 4    ///< Sub-buckets per power of two.
+#define Q_HIST_BKTS 188 ///< Enough buckets for values up to 2^48.
+
+/// Log-linear (HDR-style) histogram; see q_hist_quantile().
+struct q_hist {
+    uint64_t cnt;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t bkt[Q_HIST_BKTS];
+};
+
+
+/// Engine-wide metrics, see q_engine_stats(). Histograms are in nsec.
+struct q_engine_stats {
+    uint64_t pkts_in;          ///< UDP datagrams RX'ed.
+    uint64_t bytes_in;         ///< UDP payload bytes RX'ed.
+    uint64_t pkts_in_dec_fail; ///< Pkts that failed to decrypt.
+    uint64_t pkts_in_hint;     ///< Pkts matched to the previous pkt's conn.
+    uint64_t pkts_in_bad_tok;  ///< Initials with an invalid Retry token.
+    uint64_t pkts_out;         ///< UDP datagrams TX'ed.
+    uint64_t bytes_out;        ///< UDP payload bytes TX'ed.
+    uint64_t pkts_out_rtry;    ///< Retry pkts TX'ed.
+    uint64_t conns_refused;    ///< Server conns closed as busy on arrival.
+    uint64_t tckts_reused;     ///< Reused tickets, whose 0-RTT was refused.
+
+    uint32_t bufs;         ///< Size of the buffer pool.
+    uint32_t bufs_free;    ///< Buffers currently unallocated.
+    uint32_t accept_queue; ///< Server conns waiting for q_accept().
+    uint32_t hshks;        ///< Server handshakes in progress.
+    uint32_t timers;       ///< Timers pending in the wheel.
+    uint8_t _unused[4];
+
+    struct q_hist loop; ///< Busy time per event loop iteration.
+    struct q_hist rtt;  ///< RTT samples, over all conns.
+    struct q_hist hshk; ///< Time from conn creation to established.
+    struct q_hist rx;   ///< Processing time per RX batch.
+    struct q_hist tx;   ///< Processing time per tx() call.
+};
+
+
+/// Events delivered to the callback registered via q_set_event_cb().
+typedef enum {
+    q_ev_conn_accepted = 1, ///< Server conn ready for q_accept().
+    q_ev_strm_readable = 2, ///< Stream has new data (or was closed by peer).
+    q_ev_strm_writable = 3, ///< Stream (or conn, if s is zero) got TX credit.
+    q_ev_conn_closed = 4,   ///< Conn is closed and can be q_close()'d.
+} q_event_type_t;
+
+
+struct q_event {
+    q_event_type_t type;
+#if HAVE_64BIT
+    uint8_t _unused[4];
+#endif
+    struct q_conn * c;
+    struct q_stream * s;
+};
+
+
+typedef void (*q_event_cb)(const struct q_event * const ev, void * const arg);
+
+
+/// Stream data producer registered via q_write_fill(). Called only when the
+/// stream is about to TX, it copies up to @p max_len bytes into @p buf and
+/// returns how many it did. Returning zero without setting @p fin means no
+/// data is available yet; call q_resume_fill() once there is. If the stream
+/// goes away before @p fin is set, it is called once more with a zero @p buf
+/// so that @p arg can be released.
+typedef uint32_t (*q_fill_cb)(struct q_stream * const s,
+                              uint8_t * const buf,
+                              const uint32_t max_len,
+                              bool * const fin,
+                              void * const arg);
+
+
+/// qlog event categories, for q_qlog_filter.categories.
+#define Q_QLOG_TRANSPORT 0x01 ///< packet_sent, packet_received, ...
+#define Q_QLOG_RECOVERY 0x02  ///< metrics_updated, packet_lost
+#define Q_QLOG_TIMERS 0x04    ///< rack_timer, probe_timer
+#define Q_QLOG_ALL (Q_QLOG_TRANSPORT | Q_QLOG_RECOVERY | Q_QLOG_TIMERS)
+
+
+/// Selects which connections and events go into the qlog, see
+/// q_set_qlog_filter(). Connection criteria are evaluated when a connection
+/// starts; all that are set must match.
+struct q_qlog_filter {
+    const struct sockaddr * peer; ///< Only this peer (port zero = any port).
+    uint32_t sample;              ///< Only one in this many conns (0 = all).
+    uint8_t categories;           ///< Q_QLOG_* bitmask (0 = all).
+    uint8_t cid_prefix_len;       ///< Only conns with a CID starting with
+    uint8_t cid_prefix[20];       ///< these bytes, ours or the peer's.
+    uint8_t _unused[6];
+};
+
+
+/// Emulated link for q_netem_attach(). All connections must be between
+/// sockets of the same engine. Zero values disable the respective effect.
+struct q_netem_conf {
+    uint64_t rate;    ///< Bottleneck rate per direction, in bit/s.
+    uint64_t delay;   ///< One-way propagation delay, in ns.
+    uint64_t jitter;  ///< Uniform extra delay of up to this many ns.
+    uint64_t seed;    ///< PRNG seed; equal seeds give equal link behavior.
+    uint32_t queue;   ///< Bottleneck queue limit in bytes, tail drop.
+    uint32_t loss;    ///< Random loss, in pkts per million.
+    uint32_t reorder; ///< Pkts per million that skip the delay.
+    uint8_t _unused[4];
+};
+
+
 extern struct w_engine * __attribute__((nonnull(1)))
 q_init(const char * const ifname, const struct q_conf * const conf);
 
@@ -124,6 +265,9 @@ extern void __attribute__((nonnull(1))) q_close(struct q_conn * const c,
 extern struct q_conn * __attribute__((nonnull))
 q_bind(struct w_engine * const w, const uint16_t addr_idx, const uint16_t port);
 
+extern bool __attribute__((nonnull))
+q_reuseport_steer(const struct q_conn * const c, const uint8_t workers);
+
 extern struct q_conn * q_accept(struct w_engine * const w,
                                 const struct q_conn_conf * const conf);
 
@@ -133,6 +277,11 @@ q_is_new_serv_conn(const struct q_conn * const c);
 extern bool __attribute__((nonnull))
 q_write(struct q_stream * const s, struct w_iov_sq * const q, const bool fin);
 
+extern bool __attribute__((nonnull(1, 2)))
+q_write_fill(struct q_stream * const s, const q_fill_cb fill, void * const arg);
+
+extern void __attribute__((nonnull)) q_resume_fill(struct q_stream * const s);
+
 extern struct q_stream * __attribute__((nonnull))
 q_read(struct q_conn * const c, struct w_iov_sq * const q, const bool all);
 
@@ -215,6 +364,76 @@ q_info(struct q_conn * const c, struct q_conn_info * const ci);
 
 extern int __attribute__((nonnull)) q_conn_af(const struct q_conn * const c);
 
+extern void __attribute__((nonnull))
+q_engine_stats(struct w_engine * const w, struct q_engine_stats * const st);
+
+extern uint64_t __attribute__((nonnull))
+q_hist_quantile(const struct q_hist * const h, const double q);
+
+extern size_t __attribute__((nonnull))
+q_stats_prometheus(const struct q_engine_stats * const st,
+                   char * const buf,
+                   const size_t len);
+
+extern void __attribute__((nonnull(1)))
+q_set_event_cb(struct w_engine * const w,
+               const q_event_cb cb,
+               void * const arg);
+
+extern uint32_t __attribute__((nonnull))
+q_process(struct w_engine * const w, const uint64_t nsec);
+
+extern uint64_t __attribute__((nonnull))
+q_next_timeout(struct w_engine * const w);
+
+extern uint32_t __attribute__((nonnull))
+q_get_fds(struct w_engine * const w, int * const fds, const uint32_t fds_len);
+
+extern uint32_t __attribute__((nonnull))
+q_on_readable(struct w_engine * const w, const int fd);
+
+extern uint32_t __attribute__((nonnull))
+q_on_timeout(struct w_engine * const w);
+
+#ifndef NO_QLOG
+extern void __attribute__((nonnull(1)))
+q_set_qlog_filter(struct w_engine * const w,
+                  const struct q_qlog_filter * const f);
+
+extern void __attribute__((nonnull)) q_qlog_conn(struct q_conn * const c,
+                                                 const bool enable);
+#endif
+
+extern struct q_lb * __attribute__((nonnull))
+q_lb_new(const struct q_lb_conf * const conf);
+
+extern void __attribute__((nonnull)) q_lb_free(struct q_lb * const lb);
+
+extern bool __attribute__((nonnull))
+q_lb_sid(const struct q_lb * const lb,
+         const uint8_t * const cid,
+         const size_t cid_len,
+         uint8_t * const sid);
+
+extern size_t __attribute__((nonnull))
+q_ticket_export(const char * const sni,
+                const char * const alpn,
+                uint8_t * const buf,
+                const size_t len);
+
+extern bool __attribute__((nonnull))
+q_ticket_import(const uint8_t * const buf, const size_t len);
+
+#ifdef QUANT_NETEM
+extern void __attribute__((nonnull))
+q_netem_attach(struct w_engine * const w,
+               const struct q_netem_conf * const conf);
+
+extern void __attribute__((nonnull)) q_netem_detach(struct w_engine * const w);
+
+extern uint64_t q_netem_now(void);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,6 +32,7 @@
 
 #include "cid.h"
 #include "conn.h"
+#include "lb.h"
 #include "quic.h"
 #include "tls.h"
 
@@ -211,3 +212,22 @@ void mk_rand_cid(struct cid * const id,
         rand_bytes(id->srt, sizeof(id->srt));
 #endif
 }
+
+
+void mk_serv_cid(struct w_engine * const w,
+                 struct cid * const id,
+                 const bool slot
+#ifdef NO_MIGRATION
+                 __attribute__((unused))
+#endif
+)
+{
+    const struct q_lb * const lb = ped(w)->lb;
+    mk_rand_cid(id, lb ? lb_cid_len(lb) : ped(w)->conf.server_cid_len, true);
+    if (lb)
+        lb_enc(lb, id->id);
+#ifndef NO_MIGRATION
+    else if (slot && ped(w)->conf.enable_cid_slots)
+        cid_slot_rsv(id);
+#endif
+}
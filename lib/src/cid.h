@@ -59,10 +59,11 @@ struct cid {
     uint8_t in_cbi : 1;    ///< Is the CID in conns_by_id?
     uint8_t retired : 1;   ///< Did we retire this CID?
     uint8_t available : 1; ///< Is this CID available?
+    uint8_t slotted : 1;   ///< Does the CID encode a cid_slots index?
 #ifndef NO_SRT_MATCHING
-    uint8_t : 4;
+    uint8_t : 3;
 #else
-    uint8_t : 5;
+    uint8_t : 4;
 #endif
 #if HAVE_64BIT
     uint8_t _unused[2];
@@ -135,6 +136,9 @@ cid_retire(struct cids * const ids, struct cid * const id);
 extern void __attribute__((nonnull))
 mk_rand_cid(struct cid * const id, const uint8_t len, const bool srt);
 
+extern void __attribute__((nonnull))
+mk_serv_cid(struct w_engine * const w, struct cid * const id, const bool slot);
+
 extern const char * __attribute__((nonnull(2)))
 cid2str(const struct cid * const id, char * const dst, const size_t len_dst);
 
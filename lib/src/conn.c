@@ -56,8 +56,10 @@
 #include "qlog.h"
 #include "quic.h"
 #include "recovery.h"
+#include "stats.h"
 #include "stream.h"
 #include "tls.h"
+#include "uring.h"
 
 #ifndef NO_SERVER
 #include "kvec.h"
@@ -94,6 +96,7 @@ static inline __attribute__((const)) bool is_vneg_vers(const uint32_t vers)
 
 #ifndef NO_MIGRATION
 khash_t(conns_by_id) conns_by_id = {0};
+struct cid_slots cid_slots = {0};
 #endif
 
 
@@ -212,6 +215,16 @@ struct q_conn * get_conn_by_srt(uint8_t * const srt)
 static struct q_conn * __attribute__((nonnull))
 get_conn_by_cid(struct cid * const scid)
 {
+    if (cid_slots.cnt && scid->len >= CID_SLOT_MIN_LEN) {
+        const uint32_t i = cid_slot_idx(scid);
+        if (likely(i < kv_size(cid_slots.s))) {
+            const struct cid_slot * const s = &kv_A(cid_slots.s, i);
+            // the compare verifies the check tag
+            if (likely(s->id) && cid_cmp(s->id, scid) == 0)
+                return s->c;
+        }
+    }
+
     const khiter_t k = kh_get(conns_by_id, &conns_by_id, scid);
     if (unlikely(k == kh_end(&conns_by_id)))
         return 0;
@@ -316,8 +329,34 @@ rtx_pkt(struct w_iov * const v, struct pkt_meta * const m)
 #ifndef FUZZING
 static void do_w_tx(struct w_sock * const ws, struct w_iov_sq * const q)
 {
+    prof_start(t_tx);
+    struct q_engine_stats * const st = &ped(ws->w)->stats;
+    const struct w_iov * v;
+    sq_foreach (v, q, next) {
+        st->pkts_out++;
+        st->bytes_out += v->len;
+    }
+
+#ifdef QUANT_NETEM
+    if (ped(ws->w)->netem) {
+        // the emulator takes the pkts and delivers them later
+        netem_tx(ws, q);
+        goto done;
+    }
+#endif
+#ifdef HAVE_LIBURING
+    if (ped(ws->w)->uring) {
+        // queued on the ring, submitted at the end of the RX/TX pass
+        uring_tx(ws, q);
+        goto done;
+    }
+#endif
     w_tx(ws, q);
     w_nic_tx(ws->w);
+#if defined(QUANT_NETEM) || defined(HAVE_LIBURING)
+done:
+#endif
+    prof_stop(ws->w, prof_w_tx, t_tx);
 }
 #else
 #define do_w_tx(...)
@@ -363,8 +402,12 @@ static void __attribute__((nonnull)) tx_vneg_resp(struct w_sock * const ws,
     xv->flags = v->flags;
     log_pkt("TX", xv, &xv->saddr, 0, 0, 0);
     // qlog_transport(pkt_tx, "default", xv, mx);
+
+    // the TX path may hold on to xv, so release the metadata first
+    memset(mx, 0, sizeof(*mx));
+    ASAN_POISON_MEMORY_REGION(mx, sizeof(*mx));
     do_w_tx(ws, &q);
-    q_free(&q);
+    w_free(&q);
 }
 
 
@@ -376,7 +419,7 @@ static void __attribute__((nonnull)) update_act_scid(struct q_conn * const c)
 #endif
     // server picks a new random cid
     mk_cid_str(INF, c->scid, scid_str_prev);
-    mk_rand_cid(c->scid, ped(c->w)->conf.server_cid_len, true);
+    mk_serv_cid(c->w, c->scid, true);
     mk_cid_str(INF, c->scid, scid_str_new);
     warn(INF, "hshk switch to scid %s for %s %s conn (was %s)", scid_str_new,
          conn_state_str[c->state], conn_type(c), scid_str_prev);
@@ -386,14 +429,17 @@ static void __attribute__((nonnull)) update_act_scid(struct q_conn * const c)
 }
 
 
-static void __attribute__((nonnull)) tx_rtry(struct q_conn * const c)
+static void __attribute__((nonnull))
+tx_rtry(struct w_sock * const ws,
+        const struct w_iov * const v,
+        const struct pkt_meta * const m)
 {
 #ifdef DEBUG_EXTRA
     warn(INF, "sending retry");
 #endif
 
     struct pkt_meta * mx;
-    struct w_iov * const xv = alloc_iov(c->w, q_conn_af(c), 0, 0, &mx);
+    struct w_iov * const xv = alloc_iov(ws->w, ws->ws_af, 0, 0, &mx);
     if (unlikely(xv == 0)) {
         warn(WRN, "could not alloc iov");
         return;
@@ -404,32 +450,91 @@ static void __attribute__((nonnull)) tx_rtry(struct q_conn * const c)
 
     mx->hdr.type = LH_RTRY;
     mx->hdr.flags = LH | mx->hdr.type | (uint8_t)w_rand_uniform32(0x0f);
-    mx->hdr.vers = c->vers;
-
-    const struct cid odcid = *c->scid;
-    update_act_scid(c);
-    mk_rtry_tok(c, &odcid);
+    mx->hdr.vers = m->hdr.vers;
+
+    // everything the server needs later is in the token, so there is no conn
+    // yet; the new scid is hence not slotted
+    struct cid scid = {.seq = 0};
+    mk_serv_cid(ws->w, &scid, false);
+    uint8_t tok[MAX_TOK_LEN];
+    uint16_t tok_len;
+    mk_rtry_tok(&v->saddr, &m->hdr.dcid, &scid, TOK_RTRY, tok, &tok_len);
     uint8_t rit[RIT_LEN];
-    mk_rit(c, &odcid, mx->hdr.flags, c->dcid, c->scid, c->tok, c->tok_len, rit);
+    mk_rit(ws->w, mx->hdr.vers, &m->hdr.dcid, mx->hdr.flags, &m->hdr.scid,
+           &scid, tok, tok_len, rit);
 
     uint8_t * pos = xv->buf;
     const uint8_t * end = xv->buf + xv->len;
     enc1(&pos, end, mx->hdr.flags);
     enc4(&pos, end, mx->hdr.vers);
-    enc_lh_cids(&pos, end, mx, c->dcid, c->scid);
-    encb(&pos, end, c->tok, c->tok_len);
+    enc_lh_cids(&pos, end, mx, &m->hdr.scid, &scid);
+    encb(&pos, end, tok, tok_len);
     encb(&pos, end, rit, RIT_LEN);
 
     mx->txed = 1;
     mx->udp_len = xv->len = (uint16_t)(pos - xv->buf);
-    xv->saddr = c->peer;
+    xv->saddr = v->saddr;
 #ifndef NO_ECN
-    xv->flags = likely(c->sockopt.enable_ecn) ? ECN_ECT0 : ECN_NOT;
+    xv->flags = ECN_ECT0;
 #endif
-    log_pkt("TX", xv, &xv->saddr, c->tok, c->tok_len, rit);
+    log_pkt("TX", xv, &xv->saddr, tok, tok_len, rit);
     // qlog_transport(pkt_tx, "default", xv, mx);
-    do_w_tx(c->sock, &q);
-    q_free(&q);
+    ped(ws->w)->stats.pkts_out_rtry++;
+
+    // the TX path may hold on to xv, so release the metadata first
+    memset(mx, 0, sizeof(*mx));
+    ASAN_POISON_MEMORY_REGION(mx, sizeof(*mx));
+    do_w_tx(ws, &q);
+    w_free(&q);
+}
+
+
+static uint32_t __attribute__((nonnull))
+new_serv_conns(struct per_engine_data * const ped, const uint32_t add)
+{
+    // count server conns created in one-second windows
+    const uint64_t now = w_now();
+    if (now - ped->new_conns_t >= NS_PER_S) {
+        ped->new_conns_t = now;
+        ped->new_conns = 0;
+    }
+    ped->new_conns += add;
+    return ped->new_conns;
+}
+
+
+static bool __attribute__((nonnull)) need_rtry(const struct w_sock * const ws)
+{
+    struct per_engine_data * const ped = ped(ws->w);
+    // TODO: remove this interop hack eventually
+    if (bswap16(ws->ws_lport) == 4434 || ped->conf.force_retry)
+        return true;
+
+    // under load, make clnts prove their address before we spend state
+    return (ped->conf.retry_accept_queue &&
+            ped->aq_len >= ped->conf.retry_accept_queue) ||
+           (ped->conf.retry_new_conns &&
+            new_serv_conns(ped, 0) >= ped->conf.retry_new_conns);
+}
+
+
+static bool __attribute__((nonnull))
+serv_busy(struct per_engine_data * const ped)
+{
+    return (ped->conf.max_hshks && ped->hshks >= ped->conf.max_hshks) ||
+           (ped->conf.max_accept_queue &&
+            ped->aq_len >= ped->conf.max_accept_queue) ||
+           (ped->conf.max_new_conns &&
+            new_serv_conns(ped, 0) >= ped->conf.max_new_conns);
+}
+
+
+static void __attribute__((nonnull)) hshk_end(struct q_conn * const c)
+{
+    if (c->in_hshk) {
+        ped(c->w)->hshks--;
+        c->in_hshk = false;
+    }
 }
 #endif
 
@@ -448,8 +553,10 @@ static void __attribute__((nonnull)) do_tx_txq(struct q_conn * const c,
     if (w_iov_sq_cnt(q) > 1 && unlikely(is_lh(*sq_first(q)->buf))) {
         const bool do_pmtud =
             c->rec.max_ups == MIN_INI_LEN && pmtu > MIN_INI_LEN;
+        prof_start(t_coal);
         c->pmtud_pkt =
             coalesce(q, unlikely(do_pmtud) ? pmtu : c->rec.max_ups, do_pmtud);
+        prof_stop(c->w, prof_coalesce, t_coal);
     }
     do_w_tx(ws, q);
 
@@ -509,7 +616,8 @@ static void __attribute__((nonnull)) do_conn_mgmt(struct q_conn * const c)
         if (!is_clnt(c) && unlikely(c->tx_new_tok && c->tok_len == 0 &&
                                     c->pns[ep_init].abandoned))
             // TODO: find a better way to send NEW_TOKEN
-            mk_rtry_tok(c, c->scid);
+            mk_rtry_tok(&c->peer, c->scid, c->scid, TOK_NEW, c->tok,
+                        &c->tok_len);
 
         do_stream_id_fc(c, c->cnt_uni, false, true);
         do_stream_id_fc(c, c->cnt_bidi, true, true);
@@ -540,6 +648,9 @@ static bool __attribute__((nonnull)) tx_stream(struct q_stream * const s)
 {
     struct q_conn * const c = s->c;
 
+    if (unlikely(s->src) && c->state == conn_estb)
+        strm_pull(s);
+
     const bool has_data =
         (sq_empty(&s->out) == false && out_fully_acked(s) == false);
 
@@ -651,6 +762,7 @@ void tx(struct q_conn * const c)
     if (unlikely(c->state == conn_drng))
         return;
 
+    const uint64_t t = w_now();
     if (unlikely(c->state == conn_qlse)) {
         enter_closing(c);
         tx_ack(c, epoch_in(c), false);
@@ -710,6 +822,7 @@ done:;
     log_cc(c);
     c->needs_tx = false;
     c->tx_limit = 0;
+    hist_add(&ped(c->w)->stats.tx, w_now() - t);
 }
 
 
@@ -736,6 +849,15 @@ extern void conns_by_srt_del(uint8_t * const srt)
 void conns_by_id_ins(struct q_conn * const c, struct cid * const id)
 {
     assure(id->in_cbi == false, "already in cbi");
+    if (id->slotted) {
+        struct cid_slot * const s = &kv_A(cid_slots.s, cid_slot_idx(id));
+        assure(s->id == 0, "slot in use");
+        *s = (struct cid_slot){.id = id, .c = c};
+        cid_slots.cnt++;
+        id->in_cbi = true;
+        return;
+    }
+
     int ret;
     const khiter_t k = kh_put(conns_by_id, &conns_by_id, id, &ret);
     ensure(ret >= 1, "inserted returned %d", ret);
@@ -747,14 +869,69 @@ void conns_by_id_ins(struct q_conn * const c, struct cid * const id)
 void conns_by_id_del(struct cid * const id)
 {
     assure(id->in_cbi, "not in cbi");
+    if (id->slotted) {
+        const uint32_t i = cid_slot_idx(id);
+        kv_A(cid_slots.s, i) = (struct cid_slot){0};
+        *kv_pushp(uint32_t, cid_slots.free) = i;
+        cid_slots.cnt--;
+        id->in_cbi = id->slotted = false;
+        return;
+    }
+
     const khiter_t k = kh_get(conns_by_id, &conns_by_id, id);
     ensure(k != kh_end(&conns_by_id), "found");
     kh_del(conns_by_id, &conns_by_id, k);
     id->in_cbi = false;
 }
+
+
+void cid_slot_rsv(struct cid * const id)
+{
+    // the slot is taken off the free list here, and filled on insertion
+    uint32_t i;
+    if (kv_size(cid_slots.free))
+        i = kv_pop(cid_slots.free);
+    else if (kv_size(cid_slots.s) < CID_SLOTS_MAX) {
+        i = (uint32_t)kv_size(cid_slots.s);
+        *kv_pushp(struct cid_slot, cid_slots.s) = (struct cid_slot){0};
+    } else {
+        warn(WRN, "out of CID slots, using hashed CID");
+        return;
+    }
+
+    assure(id->len >= CID_SLOT_MIN_LEN, "CID too short for slot");
+    id->id[0] = (uint8_t)(i >> 16);
+    id->id[1] = (uint8_t)(i >> 8);
+    id->id[2] = (uint8_t)i;
+    id->slotted = true;
+}
 #endif
 
 
+// Called when tls_io() returns zero, whether on RX or after async signing.
+void hshk_progress(struct q_conn * const c)
+{
+    if (c->state != conn_idle && c->state != conn_opng)
+        return;
+
+    conn_to_state(c, conn_estb);
+    hist_add(&ped(c->w)->stats.hshk, w_now() - c->t_created);
+#ifndef NO_SERVER
+    hshk_end(c);
+#endif
+    if (is_clnt(c))
+        maybe_api_return(q_connect, c, 0);
+#ifndef NO_SERVER
+    else if (c->needs_accept == false) {
+        sl_insert_head(&accept_queue, c, node_aq);
+        ped(c->w)->aq_len++;
+        c->needs_accept = true;
+        loop_event(c, 0, q_ev_conn_accepted);
+    }
+#endif
+}
+
+
 static void __attribute__((nonnull))
 rx_crypto(struct q_conn * const c, const struct pkt_meta * const m_cur)
 {
@@ -774,20 +951,8 @@ rx_crypto(struct q_conn * const c, const struct pkt_meta * const m_cur)
         const int ret = tls_io(s, v);
         if (free_ooo && m != m_cur)
             free_iov(v, m);
-        if (ret)
-            continue;
-
-        if (c->state == conn_idle || c->state == conn_opng) {
-            conn_to_state(c, conn_estb);
-            if (is_clnt(c))
-                maybe_api_return(q_connect, c, 0);
-#ifndef NO_SERVER
-            else if (c->needs_accept == false) {
-                sl_insert_head(&accept_queue, c, node_aq);
-                c->needs_accept = true;
-            }
-#endif
-        }
+        if (ret == 0)
+            hshk_progress(c);
     }
     if (!is_clnt(c) && c->tx_hshk_done && hshk_done(c) == false)
         abandon_pn(&c->pns[pn_hshk]);
@@ -871,7 +1036,7 @@ vneg_or_rtry_resp(struct q_conn * const c, const bool is_vneg)
     c->try_0rtt = should_try_0rtt;
     tls_io(c->cstrms[ep_init], 0);
 
-    // switch to new qlog file
+    // restart the qlog trace
     if (ped(c->w)->conf.qlog_dir)
         qlog_init(c);
 }
@@ -896,12 +1061,7 @@ pkt_ok_for_epoch(const uint8_t flags, const epoch_t epoch)
 #endif
 
 
-static bool __attribute__((nonnull)) rx_pkt(const struct w_sock * const ws
-#ifdef NO_SERVER
-                                            __attribute__((unused))
-#endif
-                                            ,
-                                            struct w_iov * v,
+static bool __attribute__((nonnull)) rx_pkt(struct w_iov * v,
                                             struct pkt_meta * m,
                                             struct w_iov_sq * const x
 #if defined(NO_OOO_0RTT) || defined(NO_SERVER)
@@ -934,24 +1094,15 @@ static bool __attribute__((nonnull)) rx_pkt(const struct w_sock * const ws
             goto done;
         }
 
-        // this is a new connection
+        // this is a new connection; rx_pkts() already handled any Retry
         c->vers = m->hdr.vers;
 
-        // TODO: remove this interop hack eventually
-        if (bswap16(ws->ws_lport) == 4434 || ped(c->w)->conf.force_retry) {
-            if (m->hdr.type == LH_INIT && tok_len) {
-                if (verify_rtry_tok(c, tok, tok_len) == false) {
-                    warn(ERR, "retry token verification failed");
-                    err_close(c, ERR_INVL_TOK, 0, "invalid token %s",
-                              tok_str(tok, tok_len));
-                    enter_closing(c);
-                    goto done;
-                }
-            } else {
-                // send a RETRY
-                tx_rtry(c);
-                goto done;
-            }
+        if (unlikely(c->refuse)) {
+            // don't spend any TLS work on it
+            ped(c->w)->stats.conns_refused++;
+            err_close(c, ERR_SERVER_BUSY, 0, "server busy");
+            enter_closing(c);
+            goto done;
         }
 
 #ifdef DEBUG_EXTRA
@@ -1198,11 +1349,14 @@ static void __attribute__((nonnull))
         uint16_t tok_len = 0;
         uint8_t rit[RIT_LEN];
         bool decoal = false;
-        if (unlikely(!dec_pkt_hdr_beginning(
-                xv, v, m, x, is_clnt, tok, &tok_len, rit,
-                is_clnt ? (ws->data ? 0 : ped(ws->w)->conf.client_cid_len)
-                        : ped(ws->w)->conf.server_cid_len,
-                &decoal))) {
+        prof_start(t_hdr);
+        const bool hdr_ok = dec_pkt_hdr_beginning(
+            xv, v, m, x, is_clnt, tok, &tok_len, rit,
+            is_clnt ? (ws->data ? 0 : ped(ws->w)->conf.client_cid_len)
+                    : ped(ws->w)->conf.server_cid_len,
+            &decoal);
+        prof_stop(ws->w, prof_hdr, t_hdr);
+        if (unlikely(!hdr_ok)) {
             // we might still need to send a vneg packet
             if (w_connected(ws) == false) {
                 if (m->hdr.type == LH_INIT &&
@@ -1228,7 +1382,14 @@ static void __attribute__((nonnull))
         }
 
 #ifndef NO_MIGRATION
-        c = get_conn_by_cid(&m->hdr.dcid);
+        // in steady state, most pkts are short-header pkts for the same conn
+        // as the previous one, so try that before hashing the dcid
+        c = ped(ws->w)->rx_hint;
+        if (likely(c && !is_lh(m->hdr.flags) && m->hdr.dcid.len && c->scid &&
+                   c->scid->in_cbi && cid_cmp(&m->hdr.dcid, c->scid) == 0))
+            ped(ws->w)->stats.pkts_in_hint++;
+        else
+            c = get_conn_by_cid(&m->hdr.dcid);
         if (c == 0 && m->hdr.dcid.len == 0)
 #endif
             c = (struct q_conn *)ws->data;
@@ -1270,6 +1431,33 @@ static void __attribute__((nonnull))
                     goto drop;
                 }
 
+#ifndef NO_SERVER
+                // a client that got our Retry expects its CIDs in the TPs,
+                // even if we are no longer busy enough to require one; a
+                // NEW_TOKEN token only validates the address
+                uint8_t tok_type = TOK_NEW;
+                const bool tok_ok =
+                    tok_len && verify_rtry_tok(ws->w, &v->saddr, tok, tok_len,
+                                               &tok_type);
+                if (need_rtry(ws)) {
+                    if (tok_len == 0) {
+                        log_pkt("RX", v, &v->saddr, tok, tok_len, rit);
+                        tx_rtry(ws, v, m);
+                        goto drop;
+                    }
+                    if (tok_ok == false) {
+                        log_pkt("RX", v, &v->saddr, tok, tok_len, rit);
+                        warn(ERR, "retry token verification failed");
+                        ped(ws->w)->stats.pkts_in_bad_tok++;
+                        goto drop;
+                    }
+                } else if (unlikely(tok_len && tok_ok == false))
+                    warn(WRN, "ignoring invalid retry token");
+
+                // decide before new_conn(), which changes the counts
+                const bool busy = serv_busy(ped(ws->w));
+#endif
+
                 warn(NTE, "new serv conn on port %u from %s%s%s:%u w/cid=%s",
                      bswap16(ws->ws_lport), v->wv_af == AF_INET6 ? "[" : "",
                      w_ntop(&v->wv_addr, ip_tmp),
@@ -1279,8 +1467,21 @@ static void __attribute__((nonnull))
                 c = new_conn(w_engine(ws), UINT16_MAX, &m->hdr.scid,
                              &m->hdr.dcid, &v->saddr, 0, ws->ws_lport,
                              &(struct q_conn_conf){.version = m->hdr.vers});
-                if (likely(c))
+                if (likely(c)) {
+#ifndef NO_SERVER
+                    if (unlikely(busy))
+                        // still needs Initial keys to send the close
+                        c->refuse = true;
+                    else {
+                        new_serv_conns(ped(ws->w), 1);
+                        ped(ws->w)->hshks++;
+                        c->in_hshk = true;
+                    }
+                    if (tok_ok && tok_type == TOK_RTRY)
+                        use_rtry_tok(c, tok, tok_len);
+#endif
                     init_tls(c, 0, 0);
+                }
             }
         }
 
@@ -1289,8 +1490,8 @@ static void __attribute__((nonnull))
             if (m->hdr.scid.len && cid_cmp(&m->hdr.scid, c->dcid) != 0 &&
                 m->hdr.vers && m->hdr.type == LH_RTRY) {
                 uint8_t computed_rit[RIT_LEN];
-                mk_rit(c, c->dcid, m->hdr.flags, &m->hdr.dcid, &m->hdr.scid,
-                       tok, tok_len, computed_rit);
+                mk_rit(c->w, c->vers, c->dcid, m->hdr.flags, &m->hdr.dcid,
+                       &m->hdr.scid, tok, tok_len, computed_rit);
                 if (memcmp(rit, computed_rit, RIT_LEN) != 0) {
                     log_pkt("RX", v, &v->saddr, tok, tok_len, rit);
                     warn(ERR, "rit mismatch, computed %s",
@@ -1458,7 +1659,7 @@ static void __attribute__((nonnull))
             m->pn = &c->pns[pn_init];
 
     decoal_done:
-        if (likely(rx_pkt(ws, v, m, x, tok, tok_len, rit))) {
+        if (likely(rx_pkt(v, m, x, tok, tok_len, rit))) {
             if (unlikely(has_frm(m->frms, FRM_CRY)))
                 rx_crypto(c, m);
             c->min_rx_epoch = c->had_rx ? MIN(c->min_rx_epoch,
@@ -1476,6 +1677,9 @@ static void __attribute__((nonnull))
                 diet_insert(&pn->recv_all, m->hdr.nr, 0);
             }
             pkt_valid = true;
+#ifndef NO_MIGRATION
+            ped(ws->w)->rx_hint = c;
+#endif
 
             // remember that we had a RX event on this connection
             if (unlikely(!c->had_rx)) {
@@ -1560,9 +1764,23 @@ static void __attribute__((nonnull)) restart_ack_alarm(struct q_conn * const c)
 void rx(struct w_sock * const ws)
 {
     struct w_iov_sq x = w_iov_sq_initializer(x);
-    struct q_conn_sl crx = sl_head_initializer(crx);
     w_rx(ws, &x);
-    rx_pkts(&x, &crx, ws);
+    rx_batch(ws, &x);
+}
+
+
+void rx_batch(struct w_sock * const ws, struct w_iov_sq * const x)
+{
+    const uint64_t t = w_now();
+    struct q_engine_stats * const st = &ped(ws->w)->stats;
+    const struct w_iov * v;
+    sq_foreach (v, x, next) {
+        st->pkts_in++;
+        st->bytes_in += v->len;
+    }
+
+    struct q_conn_sl crx = sl_head_initializer(crx);
+    rx_pkts(x, &crx, ws);
 
     // for all connections that had RX events
     while (!sl_empty(&crx)) {
@@ -1609,6 +1827,10 @@ void rx(struct w_sock * const ws)
             maybe_api_return(q_ready, 0, 0);
         }
     }
+
+    const uint64_t d = w_now() - t;
+    hist_add(&st->rx, d);
+    ped(ws->w)->busy_t += d;
 }
 
 
@@ -1701,6 +1923,8 @@ static void __attribute__((nonnull)) enter_closed(struct q_conn * const c)
         c->in_c_ready = true;
     }
 
+    loop_event(c, 0, q_ev_conn_closed);
+
     // terminate whatever API call is currently active
     maybe_api_return(c, 0);
     maybe_api_return(q_ready, 0, 0);
@@ -1813,11 +2037,13 @@ struct q_conn * new_conn(struct w_engine * const w,
                          const uint16_t port,
                          const struct q_conn_conf * const conf)
 {
+    prof_start(t_new);
     struct q_conn * const c = calloc(1, sizeof(*c));
     ensure(c, "could not calloc");
 
     c->pmtud_pkt = UINT16_MAX;
     c->w = w;
+    c->t_created = w_now();
 #ifndef NO_SERVER
     c->is_clnt = peer_name != 0;
 #endif
@@ -1851,12 +2077,18 @@ struct q_conn * new_conn(struct w_engine * const w,
 #endif
     c->sockopt.enable_udp_zero_checksums =
         get_conf_uncond(c->w, conf, enable_udp_zero_checksums);
+#if !defined(NO_SERVER) && defined(HAVE_W_REUSEPORT)
+    if (peer == 0)
+        // other server processes may bind the same port
+        c->sockopt.enable_reuseport = ped(w)->conf.enable_reuseport;
+#endif
 
     if (is_clnt(c) || peer == 0) {
         c->sock = w_bind(w, idx, port, &c->sockopt);
         if (unlikely(c->sock == 0))
             goto fail;
         c->holds_sock = true;
+        socks_by_fd_ins(c->sock);
 #ifndef NO_SERVER
         if (peer == 0)
             // remember server socket
@@ -1960,8 +2192,7 @@ struct q_conn * new_conn(struct w_engine * const w,
         if (c->tp_mine.pref_addr.addr4.addr.af ||
             c->tp_mine.pref_addr.addr6.addr.af) {
             c->max_cid_seq_out = c->tp_mine.pref_addr.cid.seq = 1;
-            mk_rand_cid(&c->tp_mine.pref_addr.cid,
-                        ped(c->w)->conf.server_cid_len, true);
+            mk_serv_cid(c->w, &c->tp_mine.pref_addr.cid, true);
             conns_by_id_ins(c, cid_ins(&c->scids, &c->tp_mine.pref_addr.cid));
         }
     }
@@ -1985,6 +2216,7 @@ struct q_conn * new_conn(struct w_engine * const w,
     }
 
     conn_to_state(c, conn_idle);
+    prof_stop(w, prof_new_conn, t_new);
     return c;
 
 fail:
@@ -1995,9 +2227,14 @@ fail:
 
 void free_conn(struct q_conn * const c)
 {
+    prof_start(t_free);
+
     // exit any active API call on the connection
     maybe_api_return(c, 0);
 
+    // don't deliver pending events for this connection
+    loop_event_purge(c, 0);
+
     stop_all_alarms(c);
 
     struct q_stream * s;
@@ -2038,20 +2275,28 @@ void free_conn(struct q_conn * const c)
         conns_by_id_del(&c->tp_mine.pref_addr.cid);
     if (c->odcid.in_cbi)
         conns_by_id_del(&c->odcid);
+    if (ped(c->w)->rx_hint == c)
+        ped(c->w)->rx_hint = 0;
 #endif
-    if (c->holds_sock)
+    if (c->holds_sock) {
         // only close the socket for the final server connection
+        socks_by_fd_del(c->sock);
         w_close(c->sock);
+    }
 
     if (c->in_c_ready)
         sl_remove(&c_ready, c, q_conn, node_rx_ext);
 
 #ifndef NO_SERVER
-    if (c->needs_accept)
+    if (c->needs_accept) {
         sl_remove(&accept_queue, c, q_conn, node_aq);
+        ped(c->w)->aq_len--;
+    }
+    hshk_end(c);
 #endif
 
     qlog_close(c);
+    prof_stop(c->w, prof_free_conn, t_free);
     free(c);
 }
 
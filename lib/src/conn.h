@@ -73,6 +73,37 @@ kh_cid_cmp(const struct cid * const a, const struct cid * const b)
 KHASH_INIT(conns_by_id, struct cid *, struct q_conn *, 1, hash_cid, kh_cid_cmp)
 
 extern khash_t(conns_by_id) conns_by_id;
+
+
+#define CID_SLOT_LEN 3     ///< Leading CID bytes holding the slot index.
+#define CID_SLOT_MIN_LEN 8 ///< Minimum CID len, leaves a 5-byte check tag.
+#define CID_SLOTS_MAX (1 << (8 * CID_SLOT_LEN))
+
+struct cid_slot {
+    struct cid * id;   ///< CID in this slot, or zero if unused.
+    struct q_conn * c; ///< Connection the CID belongs to.
+};
+
+/// With q_conf.enable_cid_slots, server CIDs start with an index into this
+/// table, and the random remainder of the CID serves as a check tag. Lookups
+/// are an array access and a compare against the stored CID, without
+/// hashing. CIDs that are not ours (e.g., the client-chosen odcid) stay in
+/// conns_by_id.
+struct cid_slots {
+    kvec_t(struct cid_slot) s;
+    kvec_t(uint32_t) free; ///< Indices of unused slots.
+    uint32_t cnt;          ///< Slots in use.
+    uint8_t _unused[4];
+};
+
+extern struct cid_slots cid_slots;
+
+
+static inline uint32_t __attribute__((nonnull, no_instrument_function))
+cid_slot_idx(const struct cid * const id)
+{
+    return (uint32_t)id->id[0] << 16 | (uint32_t)id->id[1] << 8 | id->id[2];
+}
 #endif
 
 
@@ -212,7 +243,14 @@ struct q_conn {
     uint32_t tx_hshk_done : 1;      ///< Send HANDSHAKE_DONE.
     uint32_t in_c_zcid : 1;
     uint32_t tx_new_tok : 1; ///< Send NEW_TOKEN.
-    uint32_t : 3;
+#ifndef NO_SERVER
+    uint32_t in_hshk : 1; ///< Counted as a server handshake in progress.
+    uint32_t refuse : 1;  ///< Over an admission limit, close as busy.
+#else
+    uint32_t _unused_in_hshk : 1;
+    uint32_t _unused_refuse : 1;
+#endif
+    uint32_t : 1;
 
     conn_state_t state; ///< State of the connection.
 
@@ -231,6 +269,7 @@ struct q_conn {
     struct timeout ack_alarm;
 
     struct w_sockaddr peer; ///< Address of our peer.
+    uint64_t t_created;     ///< When the conn was created (for stats).
 
     struct q_stream * cstrms[ep_data + 1]; ///< Crypto "streams".
     khash_t(strms_by_id) strms_by_id;      ///< Regular streams.
@@ -303,9 +342,7 @@ struct q_conn {
     uint32_t tx_limit;
 
 #ifndef NO_QLOG
-    FILE * qlog;
-    uint64_t qlog_last_t;
-    char qlog_file[MAXPATHLEN];
+    uint32_t qlog_id; ///< Connection number in the engine's qlog, or zero.
 #endif
 };
 
@@ -341,6 +378,8 @@ extern struct q_conn_sl c_zcid;
 
 extern void __attribute__((nonnull)) tx(struct q_conn * const c);
 
+extern void __attribute__((nonnull)) hshk_progress(struct q_conn * const c);
+
 
 #ifdef NO_ERR_REASONS
 #define err_close(c, code, frm, ...) err_close_noreason(c, code, frm)
@@ -393,6 +432,9 @@ extern void __attribute__((nonnull)) conns_by_srt_del(uint8_t * const srt);
 
 extern void __attribute__((nonnull)) rx(struct w_sock * const ws);
 
+extern void __attribute__((nonnull))
+rx_batch(struct w_sock * const ws, struct w_iov_sq * const x);
+
 extern void __attribute__((nonnull))
 conn_info_populate(struct q_conn * const c);
 
@@ -429,6 +471,8 @@ extern void __attribute__((nonnull))
 conns_by_id_ins(struct q_conn * const c, struct cid * const id);
 
 extern void __attribute__((nonnull)) conns_by_id_del(struct cid * const id);
+
+extern void __attribute__((nonnull)) cid_slot_rsv(struct cid * const id);
 #endif
 
 
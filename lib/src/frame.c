@@ -405,6 +405,7 @@ dec_stream_or_crypto_frame(const uint8_t type,
             do_stream_fc(m->strm, 0);
             do_conn_fc(c, 0);
             c->have_new_data = true;
+            loop_event(c, m->strm, q_ev_strm_readable);
             maybe_api_return(q_read_stream, c, m->strm);
         }
         goto done;
@@ -824,6 +825,7 @@ dec_max_strm_data_frame(const uint8_t ** pos,
         if (s->blocked) {
             s->blocked = false;
             c->needs_tx = true;
+            loop_event(c, s, q_ev_strm_writable);
         }
         need_ctrl_update(s);
     } else if (max < s->out_data_max)
@@ -853,6 +855,7 @@ dec_max_strms_frame(const uint8_t type,
 
     if (max > *max_streams) {
         *max_streams = max;
+        loop_event(c, 0, q_ev_strm_writable);
         maybe_api_return(q_rsv_stream, c, 0);
     } else if (max < *max_streams)
         warn(NTE, "RX'ed max_%s_streams %" PRIu " < current value %" PRIu,
@@ -875,6 +878,8 @@ dec_max_data_frame(const uint8_t ** pos,
 
     if (max > c->tp_peer.max_data) {
         c->tp_peer.max_data = max;
+        if (c->blocked)
+            loop_event(c, 0, q_ev_strm_writable);
         c->blocked = false;
     } else if (max < c->tp_peer.max_data)
         warn(NTE, "MAX_DATA %" PRIu " < current value %" PRIu, max,
@@ -1151,6 +1156,7 @@ dec_reset_stream_frame(const uint8_t ** pos,
     // FIXME: not sure is this is even needed here:
     // chk_finl_size(off, s, FRM_RST);
     strm_to_state(s, strm_clsd);
+    loop_event(c, s, q_ev_strm_readable);
 
     return true;
 }
@@ -1243,6 +1249,7 @@ bool dec_frames(struct q_conn * const c,
     const uint8_t * pos = v->buf + m->hdr.hdr_len;
     const uint8_t * start = v->buf;
     const uint8_t * end = v->buf + v->len;
+    prof_start(t_frm);
 
 #if !defined(NDEBUG) && !defined(FUZZING) && defined(FUZZER_CORPUS_COLLECTION)
     // when called from the fuzzer, v->wv_af is zero
@@ -1250,7 +1257,35 @@ bool dec_frames(struct q_conn * const c,
         write_to_corpus(corpus_frm_dir, pos, (size_t)(end - pos));
 #endif
 
+    // frame types allowed in this pkt type, looked up once per pkt
+    static const struct frames frame_ok[] = {
+        [ep_init] = bitset_t_initializer(1 << FRM_PAD | 1 << FRM_PNG |
+                                         1 << FRM_CRY | 1 << FRM_CLQ |
+                                         1 << FRM_ACK | 1 << FRM_ACE),
+        [ep_0rtt] = bitset_t_initializer(
+            1 << FRM_PAD | 1 << FRM_PNG | 1 << FRM_RST | 1 << FRM_STP |
+            1 << FRM_STR | 1 << FRM_STR_09 | 1 << FRM_STR_0a | 1 << FRM_STR_0b |
+            1 << FRM_STR_0c | 1 << FRM_STR_0d | 1 << FRM_STR_0e |
+            1 << FRM_STR_0f | 1 << FRM_MCD | 1 << FRM_MSD | 1 << FRM_MSB |
+            1 << FRM_MSU | 1 << FRM_CDB | 1 << FRM_SDB | 1 << FRM_SBB |
+            1 << FRM_SBU | 1 << FRM_CID | 1 << FRM_PCL),
+        [ep_hshk] = bitset_t_initializer(1 << FRM_PAD | 1 << FRM_PNG |
+                                         1 << FRM_CRY | 1 << FRM_CLQ |
+                                         1 << FRM_ACK | 1 << FRM_ACE),
+        [ep_data] = bitset_t_initializer(
+            1 << FRM_PAD | 1 << FRM_PNG | 1 << FRM_CRY | 1 << FRM_CLQ |
+            1 << FRM_CLA | 1 << FRM_ACK | 1 << FRM_ACE | 1 << FRM_RST |
+            1 << FRM_STP | 1 << FRM_TOK | 1 << FRM_STR | 1 << FRM_STR_09 |
+            1 << FRM_STR_0a | 1 << FRM_STR_0b | 1 << FRM_STR_0c |
+            1 << FRM_STR_0d | 1 << FRM_STR_0e | 1 << FRM_STR_0f | 1 << FRM_MCD |
+            1 << FRM_MSD | 1 << FRM_MSB | 1 << FRM_MSU | 1 << FRM_CDB |
+            1 << FRM_SDB | 1 << FRM_SBB | 1 << FRM_SBU | 1 << FRM_CID |
+            1 << FRM_RTR | 1 << FRM_PCL | 1 << FRM_PRP | 1 << FRM_HSD)};
+    const struct frames * const frms_ok =
+        &frame_ok[epoch_for_pkt_type(m->hdr.type)];
+
     while (likely(pos < end)) {
+        prof_start(t_f);
         uint8_t type = *(pos++); // dec1_chk not needed here, pos is < len
 
         // special-case for optimized parsing of padding ranges
@@ -1265,36 +1300,8 @@ bool dec_frames(struct q_conn * const c,
                 break;
         }
 
-        // check that frame type is allowed in this pkt type
-        static const struct frames frame_ok[] = {
-            [ep_init] = bitset_t_initializer(1 << FRM_PAD | 1 << FRM_PNG |
-                                             1 << FRM_CRY | 1 << FRM_CLQ |
-                                             1 << FRM_ACK | 1 << FRM_ACE),
-            [ep_0rtt] = bitset_t_initializer(
-                1 << FRM_PAD | 1 << FRM_PNG | 1 << FRM_RST | 1 << FRM_STP |
-                1 << FRM_STR | 1 << FRM_STR_09 | 1 << FRM_STR_0a |
-                1 << FRM_STR_0b | 1 << FRM_STR_0c | 1 << FRM_STR_0d |
-                1 << FRM_STR_0e | 1 << FRM_STR_0f | 1 << FRM_MCD |
-                1 << FRM_MSD | 1 << FRM_MSB | 1 << FRM_MSU | 1 << FRM_CDB |
-                1 << FRM_SDB | 1 << FRM_SBB | 1 << FRM_SBU | 1 << FRM_CID |
-                1 << FRM_PCL),
-            [ep_hshk] = bitset_t_initializer(1 << FRM_PAD | 1 << FRM_PNG |
-                                             1 << FRM_CRY | 1 << FRM_CLQ |
-                                             1 << FRM_ACK | 1 << FRM_ACE),
-            [ep_data] = bitset_t_initializer(
-                1 << FRM_PAD | 1 << FRM_PNG | 1 << FRM_CRY | 1 << FRM_CLQ |
-                1 << FRM_CLA | 1 << FRM_ACK | 1 << FRM_ACE | 1 << FRM_RST |
-                1 << FRM_STP | 1 << FRM_TOK | 1 << FRM_STR | 1 << FRM_STR_09 |
-                1 << FRM_STR_0a | 1 << FRM_STR_0b | 1 << FRM_STR_0c |
-                1 << FRM_STR_0d | 1 << FRM_STR_0e | 1 << FRM_STR_0f |
-                1 << FRM_MCD | 1 << FRM_MSD | 1 << FRM_MSB | 1 << FRM_MSU |
-                1 << FRM_CDB | 1 << FRM_SDB | 1 << FRM_SBB | 1 << FRM_SBU |
-                1 << FRM_CID | 1 << FRM_RTR | 1 << FRM_PCL | 1 << FRM_PRP |
-                1 << FRM_HSD)};
         if (likely(type < FRM_MAX) &&
-            unlikely(bit_isset(FRM_MAX, type,
-                               &frame_ok[epoch_for_pkt_type(m->hdr.type)]) ==
-                     false))
+            unlikely(bit_isset(FRM_MAX, type, frms_ok) == false))
             err_close_return(c, ERR_PV, type, "0x%02x frame not OK in %s pkt",
                              type, pkt_type_str(m->hdr.flags, &m->hdr.vers));
 
@@ -1428,6 +1435,13 @@ bool dec_frames(struct q_conn * const c,
 
         // record this frame type in the meta data
         track_frame(m, ci, type, 1);
+
+#ifdef QUANT_PROFILE
+        if (type == FRM_ACK)
+            prof_stop(c->w, prof_ack, t_f);
+        else if (type == FRM_STR || type == FRM_CRY)
+            prof_stop(c->w, prof_strm, t_f);
+#endif
     }
 
     if (m->strm_data_pos) {
@@ -1440,6 +1454,7 @@ bool dec_frames(struct q_conn * const c,
     struct pn_space * const pn = pn_for_pkt_type(c, m->hdr.type);
     bit_or(FRM_MAX, &pn->rx_frames, &m->frms);
 
+    prof_stop(c->w, prof_frm, t_frm);
     return true;
 }
 
@@ -1475,7 +1490,7 @@ uint16_t max_frame_len(const uint8_t type)
 
     case FRM_TOK:
         // only true on TX; update when mk_rtry_tok() changes
-        len += sizeof(uint_t) + PTLS_MAX_DIGEST_SIZE + CID_LEN_MAX;
+        len += sizeof(uint_t) + PTLS_MAX_DIGEST_SIZE + 1 + CID_LEN_MAX;
         break;
 
     case FRM_MCD:
@@ -1943,10 +1958,10 @@ void enc_new_cid_frame(struct q_conn_info * const ci,
         srt = enc_cid->srt;
 #endif
     } else {
-        mk_rand_cid(&ncid,
-                    is_clnt(c) ? ped(c->w)->conf.client_cid_len
-                               : ped(c->w)->conf.server_cid_len,
-                    true);
+        if (is_clnt(c))
+            mk_rand_cid(&ncid, ped(c->w)->conf.client_cid_len, true);
+        else
+            mk_serv_cid(c->w, &ncid, true);
         conns_by_id_ins(c, cid_ins(&c->scids, &ncid));
 #ifndef NO_SRT_MATCHING
         srt = ncid.srt;
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <picotls.h>
+#include <quant/quant.h>
+
+#ifdef WITH_OPENSSL
+#include <picotls/openssl.h>
+#define aes128ecb ptls_openssl_aes128ecb
+#else
+#include <picotls/minicrypto.h>
+#define aes128ecb ptls_minicrypto_aes128ecb
+#endif
+
+#include "cid.h"
+#include "lb.h"
+
+
+#define LB_BLOCK_LEN 16
+
+
+struct q_lb {
+    struct q_lb_conf conf;
+    ptls_cipher_context_t * enc; ///< Zero in plaintext mode.
+    ptls_cipher_context_t * dec;
+};
+
+
+struct q_lb * q_lb_new(const struct q_lb_conf * const conf)
+{
+    const uint8_t len = 1 + conf->sid_len + conf->nonce_len;
+    if (conf->sid_len == 0 || conf->sid_len > sizeof(conf->sid) ||
+        conf->cr >= LB_CR_UNROUTABLE || len > CID_LEN_MAX) {
+        warn(ERR, "invalid QUIC-LB config: sid_len %u, nonce_len %u, cr %u",
+             conf->sid_len, conf->nonce_len, conf->cr);
+        return 0;
+    }
+
+    if (conf->key == 0 && conf->nonce_len < 4) {
+        warn(ERR, "QUIC-LB plaintext mode needs a nonce of at least 4 bytes");
+        return 0;
+    }
+
+    // only the single-pass block cipher mode, where sid and nonce fill one
+    // AES block exactly, is supported
+    if (conf->key && conf->sid_len + conf->nonce_len != LB_BLOCK_LEN) {
+        warn(ERR, "QUIC-LB block cipher mode needs sid_len + nonce_len == %u",
+             LB_BLOCK_LEN);
+        return 0;
+    }
+
+    struct q_lb * const lb = calloc(1, sizeof(*lb));
+    ensure(lb, "could not calloc");
+    lb->conf = *conf;
+    lb->conf.key = 0;
+    if (conf->key) {
+        lb->enc = ptls_cipher_new(&aes128ecb, 1, conf->key);
+        lb->dec = ptls_cipher_new(&aes128ecb, 0, conf->key);
+        ensure(lb->enc && lb->dec, "could not make AES-ECB ctx");
+    }
+    return lb;
+}
+
+
+void q_lb_free(struct q_lb * const lb)
+{
+    if (lb->enc) {
+        ptls_cipher_free(lb->enc);
+        ptls_cipher_free(lb->dec);
+    }
+    free(lb);
+}
+
+
+bool q_lb_sid(const struct q_lb * const lb,
+              const uint8_t * const cid,
+              const size_t cid_len,
+              uint8_t * const sid)
+{
+    const uint8_t len = lb_cid_len(lb);
+    if (cid_len != len || cid[0] >> 5 != lb->conf.cr ||
+        (cid[0] & 0x1f) != len - 1)
+        return false;
+
+    if (lb->dec) {
+        uint8_t pt[LB_BLOCK_LEN];
+        ptls_cipher_encrypt(lb->dec, pt, &cid[1], sizeof(pt));
+        memcpy(sid, pt, lb->conf.sid_len);
+    } else
+        memcpy(sid, &cid[1], lb->conf.sid_len);
+    return true;
+}
+
+
+uint8_t lb_cid_len(const struct q_lb * const lb)
+{
+    return 1 + lb->conf.sid_len + lb->conf.nonce_len;
+}
+
+
+bool lb_is_plain(const struct q_lb * const lb)
+{
+    return lb->enc == 0;
+}
+
+
+void lb_enc(const struct q_lb * const lb, uint8_t * const cid)
+{
+    // the caller has filled the CID with random bytes, which become the nonce
+    const uint8_t len = lb_cid_len(lb);
+    cid[0] = (uint8_t)(lb->conf.cr << 5 | (len - 1));
+    memcpy(&cid[1], lb->conf.sid, lb->conf.sid_len);
+    if (lb->enc)
+        ptls_cipher_encrypt(lb->enc, &cid[1], &cid[1], LB_BLOCK_LEN);
+}
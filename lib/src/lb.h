@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// QUIC-LB style server CIDs (draft-ietf-quic-load-balancers). The first
+// octet holds the config rotation codepoint in its top three bits and the
+// length of the rest of the CID in its low five bits. It is followed by the
+// server ID and a nonce, either in plaintext or, with a key, encrypted as a
+// single AES-128 block.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <quant/quant.h>
+
+
+#define LB_CR_UNROUTABLE 0x07 ///< Config rotation codepoint for random CIDs.
+
+
+extern uint8_t __attribute__((nonnull))
+lb_cid_len(const struct q_lb * const lb);
+
+extern bool __attribute__((nonnull)) lb_is_plain(const struct q_lb * const lb);
+
+extern void __attribute__((nonnull))
+lb_enc(const struct q_lb * const lb, uint8_t * const cid);
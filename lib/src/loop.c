@@ -27,12 +27,16 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/param.h>
 
 #include <timeout.h>
 
 #include "conn.h"
 #include "loop.h"
+#include "qlog.h"
 #include "quic.h"
+#include "stats.h"
+#include "uring.h"
 
 
 #if !HAVE_64BIT
@@ -64,6 +68,80 @@ void loop_init(void)
 }
 
 
+void loop_timers(struct w_engine * const w)
+{
+    const uint64_t now = w_now();
+    timeouts_update(ped(w)->wheel, now);
+
+    struct timeout * t;
+    while ((t = timeouts_get(ped(w)->wheel)) != 0)
+        (*t->callback.fn)(t->callback.arg);
+
+#ifdef HAVE_LIBURING
+    if (ped(w)->uring)
+        // submit anything the timers TX'ed in one go
+        uring_flush(w);
+#endif
+    ped(w)->busy_t += w_now() - now;
+}
+
+
+bool loop_rx(struct w_engine * const w, const uint64_t nsec)
+{
+#ifdef QUANT_NETEM
+    if (ped(w)->netem)
+        return netem_rx(w, nsec);
+#endif
+#ifdef HAVE_LIBURING
+    if (ped(w)->uring)
+        return uring_rx(w, nsec);
+#endif
+
+    if (w_nic_rx(w, (int64_t)nsec) == false)
+        return false;
+
+    struct w_sock_slist sl = w_sock_slist_initializer(sl);
+    if (w_rx_ready(w, &sl) == 0)
+        return false;
+
+    // this actually matters
+    timeouts_update(ped(w)->wheel, w_now());
+
+    struct w_sock * ws;
+    sl_foreach (ws, &sl, next)
+        rx(ws);
+    return true;
+}
+
+
+bool loop_once(struct w_engine * const w, const uint64_t nsec)
+{
+    loop_timers(w);
+    if (unlikely(break_loop))
+        return false;
+
+    const uint64_t next = MIN(nsec, timeouts_timeout(ped(w)->wheel));
+    assure(next || nsec == 0, "next is null");
+    qlog_idle(w);
+    const bool ret = loop_rx(w, next);
+
+    // timers and RX processing, but not the time spent waiting for I/O
+    hist_add(&ped(w)->stats.loop, ped(w)->busy_t);
+    ped(w)->busy_t = 0;
+    return ret;
+}
+
+
+uint32_t loop_timer_cnt(struct w_engine * const w)
+{
+    uint32_t n = 0;
+    struct timeout * t;
+    TIMEOUTS_FOREACH (t, ped(w)->wheel, TIMEOUTS_PENDING)
+        n++;
+    return n;
+}
+
+
 void __attribute__((nonnull(1))) loop_run(struct w_engine * const w,
                                           const func_ptr f,
                                           struct q_conn * const c,
@@ -75,34 +153,63 @@ void __attribute__((nonnull(1))) loop_run(struct w_engine * const w,
     api_strm = s;
     break_loop = false;
 
-    while (likely(break_loop == false)) {
-        timeouts_update(ped(w)->wheel, w_now());
+    while (likely(break_loop == false))
+        loop_once(w, UINT64_MAX);
 
-        struct timeout * t;
-        while ((t = timeouts_get(ped(w)->wheel)) != 0)
-            (*t->callback.fn)(t->callback.arg);
-
-        if (unlikely(break_loop))
-            break;
+    api_func = 0;
+    api_conn = api_strm = 0;
+}
 
-        const uint64_t next = timeouts_timeout(ped(w)->wheel);
-        assure(next, "next is null");
 
-        if (w_nic_rx(w, (int64_t)next) == false)
-            continue;
+void loop_event(struct q_conn * const c,
+                struct q_stream * const s,
+                const q_event_type_t type)
+{
+    struct per_engine_data * const ped = ped(c->w);
+    if (likely(ped->event_cb == 0))
+        return;
+
+    // coalesce with the most recently queued event, if it is identical
+    const size_t n = kv_size(ped->events);
+    if (n) {
+        const struct q_event * const last = &kv_A(ped->events, n - 1);
+        if (last->type == type && last->c == c && last->s == s)
+            return;
+    }
 
-        struct w_sock_slist sl = w_sock_slist_initializer(sl);
-        if (w_rx_ready(w, &sl) == 0)
-            continue;
+    struct q_event * const ev = kv_pushp(struct q_event, ped->events);
+    ev->type = type;
+    ev->c = c;
+    ev->s = s;
+}
 
-        // this actually matters
-        timeouts_update(ped(w)->wheel, w_now());
 
-        struct w_sock * ws;
-        sl_foreach (ws, &sl, next)
-            rx(ws);
+void loop_event_purge(const struct q_conn * const c,
+                      const struct q_stream * const s)
+{
+    struct per_engine_data * const ped = ped(c->w);
+    for (size_t i = 0; i < kv_size(ped->events); i++) {
+        struct q_event * const ev = &kv_A(ped->events, i);
+        if (ev->c == c && (s == 0 || ev->s == s))
+            // mark as delivered; the queue may be in the process of draining
+            ev->c = 0;
     }
+}
 
-    api_func = 0;
-    api_conn = api_strm = 0;
+
+uint32_t loop_event_deliver(struct w_engine * const w)
+{
+    struct per_engine_data * const ped = ped(w);
+    uint32_t n = 0;
+
+    // callbacks may queue further events, which are delivered as well
+    for (size_t i = 0; i < kv_size(ped->events); i++) {
+        const struct q_event ev = kv_A(ped->events, i);
+        if (ev.c == 0)
+            continue;
+        ped->event_cb(&ev, ped->event_arg);
+        n++;
+    }
+    kv_size(ped->events) = 0;
+    return n;
 }
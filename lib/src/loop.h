@@ -53,6 +53,28 @@ extern void __attribute__((nonnull(1))) loop_run(struct w_engine * const w,
                                                  struct q_conn * const c,
                                                  struct q_stream * const s);
 
+extern void __attribute__((nonnull)) loop_timers(struct w_engine * const w);
+
+extern bool __attribute__((nonnull))
+loop_rx(struct w_engine * const w, const uint64_t nsec);
+
+extern bool __attribute__((nonnull))
+loop_once(struct w_engine * const w, const uint64_t nsec);
+
+extern uint32_t __attribute__((nonnull))
+loop_timer_cnt(struct w_engine * const w);
+
+extern void __attribute__((nonnull(1))) loop_event(struct q_conn * const c,
+                                                   struct q_stream * const s,
+                                                   const q_event_type_t type);
+
+extern void __attribute__((nonnull(1)))
+loop_event_purge(const struct q_conn * const c,
+                 const struct q_stream * const s);
+
+extern uint32_t __attribute__((nonnull))
+loop_event_deliver(struct w_engine * const w);
+
 
 // see https://stackoverflow.com/a/45600545/2240756
 //
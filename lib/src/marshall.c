@@ -273,54 +273,6 @@ bool dec8(uint64_t * const val,
 }
 
 
-bool decv(uint64_t * const val,
-          const uint8_t ** const pos,
-          const uint8_t * const end)
-{
-    switch (**pos & 0xc0) {
-    case 0xc0:
-        if (unlikely(*pos + 8 > end))
-            return false;
-#if !HAVE_64BIT
-        return false;
-#else
-        *val =
-            ((uint64_t)(*(*pos + 0) & 0x3f) << 56) +
-            ((uint64_t)(*(*pos + 1)) << 48) + ((uint64_t)(*(*pos + 1)) << 48) +
-            ((uint64_t)(*(*pos + 2)) << 40) + ((uint64_t)(*(*pos + 3)) << 32) +
-            ((uint64_t)(*(*pos + 4)) << 24) + ((uint64_t)(*(*pos + 5)) << 16) +
-            ((uint64_t)(*(*pos + 6)) << 8) + ((uint64_t)(*(*pos + 7)) << 0);
-        *pos += 8;
-        return true;
-#endif
-    case 0x80:
-        if (unlikely(*pos + 4 > end))
-            return false;
-        *val = ((uint64_t)(*(*pos + 0) & 0x3f) << 24) +
-               ((uint64_t)(*(*pos + 1)) << 16) +
-               ((uint64_t)(*(*pos + 2)) << 8) + ((uint64_t)(*(*pos + 3)) << 0);
-        *pos += 4;
-        return true;
-
-    case 0x40:
-        if (unlikely(*pos + 2 > end))
-            return false;
-        *val = ((uint64_t)(*(*pos + 0) & 0x3f) << 8) + (uint64_t)(*(*pos + 1));
-        *pos += 2;
-        return true;
-
-    case 0x00:
-        if (unlikely(*pos + 1 > end))
-            return false;
-        *val = (**pos) & 0x3f;
-        *pos += 1;
-        return true;
-    }
-
-    return false;
-}
-
-
 bool decb(uint8_t * const val,
           const uint8_t ** const pos,
           const uint8_t * const end,
@@ -0,0 +1,303 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <quant/quant.h>
+
+#ifdef QUANT_NETEM
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/param.h>
+
+#include <timeout.h>
+
+#include "conn.h"
+#include "kvec.h"
+#include "netem.h"
+#include "quic.h"
+#include "tree.h"
+
+
+/// A pkt on the emulated link, ordered by delivery time.
+struct ne_pkt {
+    splay_entry(ne_pkt) node;
+    uint64_t t;          ///< Virtual delivery time.
+    uint64_t seq;        ///< Tiebreaker, keeps FIFO order for equal times.
+    struct w_iov * v;    ///< The pkt itself.
+    struct w_sock * dst; ///< Socket the pkt is delivered to.
+};
+
+
+static inline int __attribute__((nonnull))
+ne_pkt_cmp(const struct ne_pkt * const a, const struct ne_pkt * const b)
+{
+    if (a->t != b->t)
+        return (a->t > b->t) - (a->t < b->t);
+    return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+
+splay_head(ne_by_t, ne_pkt);
+
+SPLAY_PROTOTYPE(ne_by_t, ne_pkt, node, ne_pkt_cmp)
+SPLAY_GENERATE(ne_by_t, ne_pkt, node, ne_pkt_cmp)
+
+
+/// Bottleneck state of one direction, identified by its port pair.
+struct ne_dir {
+    uint64_t free_t; ///< When the bottleneck has sent its queue.
+    uint16_t src;
+    uint16_t dst;
+    uint8_t _unused[4];
+};
+
+
+struct netem {
+    struct q_netem_conf conf;
+    struct ne_by_t pkts;
+    kvec_t(struct ne_dir) dirs;
+    uint64_t rand; ///< PRNG state.
+    uint64_t seq;
+    uint64_t delivered;
+    uint64_t lost;
+    uint64_t dropped;
+};
+
+
+uint64_t netem_t = 0;
+static uint32_t netem_users = 0;
+
+
+static uint64_t __attribute__((nonnull)) ne_rand(struct netem * const ne)
+{
+    // splitmix64, so that a run only depends on the seed
+    uint64_t z = (ne->rand += UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+
+static bool __attribute__((nonnull))
+ne_chance(struct netem * const ne, const uint32_t ppm)
+{
+    return ppm && ne_rand(ne) % 1000000 < ppm;
+}
+
+
+static struct ne_dir * __attribute__((nonnull))
+get_dir(struct netem * const ne, const uint16_t src, const uint16_t dst)
+{
+    for (size_t i = 0; i < kv_size(ne->dirs); i++) {
+        struct ne_dir * const d = &kv_A(ne->dirs, i);
+        if (d->src == src && d->dst == dst)
+            return d;
+    }
+    struct ne_dir * const d = kv_pushp(struct ne_dir, ne->dirs);
+    *d = (struct ne_dir){.src = src, .dst = dst};
+    return d;
+}
+
+
+static struct w_sock * __attribute__((nonnull))
+get_sock(struct w_engine * const w, const struct w_sockaddr * const sa)
+{
+    // all sockets are on the same engine, so the port alone identifies them,
+    // also when client and server use different address families
+    struct w_sock * ws;
+    kh_foreach_value(&ped(w)->socks_by_fd, ws, {
+        if (ws->ws_lport == sa->port)
+            return ws;
+    });
+    return 0;
+}
+
+
+void netem_attach(struct w_engine * const w,
+                  const struct q_netem_conf * const conf)
+{
+    struct netem * ne = ped(w)->netem;
+    if (ne == 0) {
+        ne = calloc(1, sizeof(*ne));
+        ensure(ne, "could not calloc");
+        splay_init(&ne->pkts);
+        kv_init(ne->dirs);
+        ped(w)->netem = ne;
+
+        // the virtual clock continues from the real one
+        if (netem_users++ == 0)
+            netem_t = (w_now)();
+    }
+
+    // reconfiguring restarts the PRNG, but keeps the pkts in flight
+    ne->conf = *conf;
+    ne->rand = conf->seed;
+    warn(NTE,
+         "netem: rate %" PRIu64 " bit/s, delay %" PRIu64 " ns, jitter %" PRIu64
+         " ns, queue %u B, loss %u ppm, reorder %u ppm",
+         conf->rate, conf->delay, conf->jitter, conf->queue, conf->loss,
+         conf->reorder);
+}
+
+
+void netem_detach(struct w_engine * const w)
+{
+    struct netem * const ne = ped(w)->netem;
+    warn(NTE,
+         "netem: %" PRIu64 " pkts delivered, %" PRIu64 " lost, %" PRIu64
+         " dropped, %u in flight",
+         ne->delivered, ne->lost, ne->dropped, splay_count(&ne->pkts));
+
+    while (!splay_empty(&ne->pkts)) {
+        struct ne_pkt * const p = splay_min(ne_by_t, &ne->pkts);
+        splay_remove(ne_by_t, &ne->pkts, p);
+        w_free_iov(p->v);
+        free(p);
+    }
+    kv_destroy(ne->dirs);
+    free(ne);
+    ped(w)->netem = 0;
+
+    if (--netem_users == 0)
+        netem_t = 0;
+}
+
+
+void netem_del_sock(struct w_sock * const ws)
+{
+    // drop what is still in flight towards a socket that is going away
+    struct netem * const ne = ped(ws->w)->netem;
+    struct ne_pkt * p = splay_min(ne_by_t, &ne->pkts);
+    while (p) {
+        struct ne_pkt * const nxt = splay_next(ne_by_t, &ne->pkts, p);
+        if (p->dst == ws) {
+            splay_remove(ne_by_t, &ne->pkts, p);
+            w_free_iov(p->v);
+            free(p);
+        }
+        p = nxt;
+    }
+}
+
+
+void netem_tx(struct w_sock * const ws, struct w_iov_sq * const q)
+{
+    struct netem * const ne = ped(ws->w)->netem;
+    const struct q_netem_conf * const conf = &ne->conf;
+
+    while (!sq_empty(q)) {
+        struct w_iov * const v = sq_first(q);
+        sq_remove_head(q, next);
+        sq_next(v, next) = 0;
+
+        // connected (client) sockets don't set the destination on the pkt
+        const struct w_sockaddr * const to =
+            w_connected(ws) ? &ws->ws_rem : &v->saddr;
+        struct w_sock * const dst = get_sock(ws->w, to);
+        if (unlikely(dst == 0) || ne_chance(ne, conf->loss)) {
+            ne->lost++;
+            w_free_iov(v);
+            continue;
+        }
+
+        uint64_t t = netem_t;
+        if (conf->rate) {
+            // serialize behind the pkts queued at the bottleneck
+            struct ne_dir * const d = get_dir(ne, ws->ws_lport, to->port);
+            const uint64_t start = MAX(netem_t, d->free_t);
+            const double queued =
+                (double)(start - netem_t) * conf->rate / (8.0 * NS_PER_S);
+            if (conf->queue && queued + v->len > conf->queue) {
+                // tail drop
+                ne->dropped++;
+                w_free_iov(v);
+                continue;
+            }
+            d->free_t = start + (uint64_t)v->len * 8 * NS_PER_S / conf->rate;
+            t = d->free_t;
+        }
+
+        // reordered pkts skip the delay, and so overtake those in flight
+        if (ne_chance(ne, conf->reorder) == false)
+            t += conf->delay +
+                 (conf->jitter ? ne_rand(ne) % (conf->jitter + 1) : 0);
+
+        // the receiver sees the sending socket as the source
+        v->saddr = ws->ws_loc;
+
+        struct ne_pkt * const p = calloc(1, sizeof(*p));
+        ensure(p, "could not calloc");
+        p->t = t;
+        p->seq = ne->seq++;
+        p->v = v;
+        p->dst = dst;
+        splay_insert(ne_by_t, &ne->pkts, p);
+    }
+}
+
+
+bool netem_rx(struct w_engine * const w, const uint64_t nsec)
+{
+    struct netem * const ne = ped(w)->netem;
+    struct ne_pkt * p = splay_min(ne_by_t, &ne->pkts);
+
+    // instead of waiting, jump to the next delivery or the deadline
+    const uint64_t until =
+        nsec >= UINT64_MAX - netem_t ? UINT64_MAX : netem_t + nsec;
+    if (p == 0 || p->t > until) {
+        if (until != UINT64_MAX)
+            netem_t = until;
+        return false;
+    }
+    netem_t = MAX(netem_t, p->t);
+    timeouts_update(ped(w)->wheel, netem_t);
+
+    // deliver all pkts that are due, batched by destination socket; RX may
+    // TX or close sockets and so change the tree, hence always restart at min
+    struct w_iov_sq x = w_iov_sq_initializer(x);
+    struct w_sock * x_ws = 0;
+    while ((p = splay_min(ne_by_t, &ne->pkts)) && p->t <= netem_t) {
+        if (p->dst != x_ws && x_ws) {
+            rx_batch(x_ws, &x);
+            sq_init(&x);
+            x_ws = 0;
+            continue;
+        }
+        splay_remove(ne_by_t, &ne->pkts, p);
+        x_ws = p->dst;
+        sq_insert_tail(&x, p->v, next);
+        ne->delivered++;
+        free(p);
+    }
+    if (x_ws)
+        rx_batch(x_ws, &x);
+    return true;
+}
+
+#endif
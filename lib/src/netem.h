@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// In-process network emulator, enabled with -DQUANT_NETEM. While attached to
+// an engine, TX'ed pkts bypass the sockets and are delivered to the engine's
+// own sockets after an emulated link delay, and w_now() returns a virtual
+// clock that jumps ahead whenever the engine would otherwise wait.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <quant/quant.h>
+
+#ifdef QUANT_NETEM
+
+
+struct netem;
+
+
+extern uint64_t netem_t;
+
+
+// in the library, time is virtual while an emulator is attached; (w_now)()
+// still gets the real clock
+#define w_now() (unlikely(netem_t) ? netem_t : (w_now)())
+
+
+extern void __attribute__((nonnull))
+netem_attach(struct w_engine * const w, const struct q_netem_conf * const conf);
+
+extern void __attribute__((nonnull)) netem_detach(struct w_engine * const w);
+
+extern void __attribute__((nonnull)) netem_del_sock(struct w_sock * const ws);
+
+extern bool __attribute__((nonnull))
+netem_rx(struct w_engine * const w, const uint64_t nsec);
+
+extern void __attribute__((nonnull))
+netem_tx(struct w_sock * const ws, struct w_iov_sq * const q);
+
+#endif
@@ -414,6 +414,7 @@ bool enc_pkt(struct q_stream * const s,
              struct w_iov * const v,
              struct pkt_meta * const m)
 {
+    prof_start(t_enc_pkt);
     if (likely(enc_data))
         // prepend the header by adjusting the buffer offset
         adj_iov_to_start(v, m);
@@ -623,7 +624,9 @@ tx:;
         return false;
     }
 
+    prof_start(t_enc);
     const uint16_t ret = enc_aead(v, m, xv, (uint16_t)(pkt_nr_pos - v->buf));
+    prof_stop(c->w, prof_enc, t_enc);
     if (unlikely(ret == 0)) {
         adj_iov_to_start(v, m);
         return false;
@@ -674,6 +677,7 @@ tx:;
             abandon_pn(&c->pns[ep_init]);
     }
 
+    prof_stop(c->w, prof_enc_pkt, t_enc_pkt);
     return true;
 }
 
@@ -1038,9 +1042,13 @@ bool dec_pkt_hdr_remainder(struct w_iov * const xv,
         unlikely(is_lh(m->hdr.flags))
             ? m->hdr.hdr_len + m->hdr.len - pkt_nr_len(m->hdr.flags)
             : xv->len;
+    prof_start(t_dec);
     const uint16_t ret = dec_aead(xv, v, m, pkt_len, ctx);
-    if (unlikely(ret == 0))
+    prof_stop(c->w, prof_dec, t_dec);
+    if (unlikely(ret == 0)) {
+        ped(c->w)->stats.pkts_in_dec_fail++;
         goto check_srt;
+    }
 
     const uint8_t rsvd_bits =
         m->hdr.flags & (is_lh(m->hdr.flags) ? LH_RSVD_MASK : SH_RSVD_MASK);
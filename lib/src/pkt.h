@@ -67,7 +67,7 @@ struct q_stream; // IWYU pragma: no_forward_declare q_stream
 
 #define ERR_NONE 0x0
 #define ERR_INTL 0x1
-// #define ERR_SERVER_BUSY 0x2
+#define ERR_SERVER_BUSY 0x2
 #define ERR_FC 0x3
 #define ERR_STRM_LIMT 0x4
 #define ERR_STRM_STAT 0x5
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+// Optional timing of hot-path stages, enabled with -DQUANT_PROFILE. Without
+// it, all macros below expand to nothing.
+
+#ifdef QUANT_PROFILE
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROF_UNIT "cycles"
+#define prof_now() __rdtsc()
+#else
+#include <time.h>
+#define PROF_UNIT "ns"
+static inline uint64_t prof_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_S + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+#include "stats.h"
+
+struct w_engine; // IWYU pragma: no_forward_declare w_engine
+
+
+typedef enum {
+    prof_hdr,       ///< dec_pkt_hdr_beginning()
+    prof_dec,       ///< dec_aead()
+    prof_frm,       ///< dec_frames(), including the two stages below
+    prof_ack,       ///< dec_ack_frame(), including recovery
+    prof_strm,      ///< dec_stream_or_crypto_frame(), including delivery
+    prof_tls_io,    ///< tls_io()
+    prof_init_tls,  ///< init_tls()
+    prof_new_conn,  ///< new_conn()
+    prof_free_conn, ///< free_conn()
+    prof_enc_pkt,   ///< enc_pkt(), including encryption
+    prof_enc,       ///< enc_aead()
+    prof_coalesce,  ///< coalesce()
+    prof_w_tx,      ///< do_w_tx(), i.e., handing pkts to the OS, ring or netem
+    PROF_STAGES
+} prof_stage_t;
+
+
+#define prof_start(t) const uint64_t t = prof_now()
+
+#define prof_stop(w, stage, t)                                                 \
+    hist_add(&ped(w)->prof[(stage)], prof_now() - (t))
+
+extern void __attribute__((nonnull)) prof_dump(struct w_engine * const w);
+
+#else
+
+#define prof_start(...)
+#define prof_stop(...)
+
+#define prof_dump(...)                                                         \
+    do {                                                                       \
+    } while (0)
+
+#endif
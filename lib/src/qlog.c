@@ -29,10 +29,18 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <quant/quant.h>
 
@@ -43,56 +51,282 @@
 #include "pkt.h"
 #include "pn.h"
 #include "qlog.h"
+#include "qlog_bin.h"
 #include "quic.h"
 #include "recovery.h"
 #include "stream.h"
 
 
-static const char * __attribute__((const, nonnull))
-qlog_pkt_type_str(const uint8_t flags, const void * const vers)
+#define QLOG_RING_LEN (4 * 1024 * 1024) ///< Ring size, must be a power of 2.
+#define QLOG_REC_MAX 1024               ///< Largest record we produce.
+#define QLOG_IDLE_NS 1000000            ///< Writer sleep when ring is empty.
+
+
+// head and tail sit on their own cache lines, so the ring is padded anyway
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wpadded"
+
+/// Single-producer (event loop), single-consumer (writer) byte ring.
+struct qlog_ring {
+    _Atomic uint64_t head __attribute__((aligned(64))); ///< Producer pos.
+    _Atomic uint64_t tail __attribute__((aligned(64))); ///< Consumer pos.
+    _Atomic bool stop;    ///< Tell the writer thread to exit.
+    bool have_thr;        ///< Is a writer thread draining the ring?
+    uint8_t cats;         ///< Q_QLOG_* categories to log.
+    uint8_t cid_len;      ///< Length of the CID prefix to match, if any.
+    uint32_t next_id;     ///< Next connection number to hand out.
+    uint32_t sample;      ///< Log one in this many conns.
+    uint32_t seen;        ///< Conns considered for sampling.
+    struct w_sockaddr peer;   ///< Peer to match, if addr.af is set.
+    uint8_t cid[CID_LEN_MAX]; ///< CID prefix to match.
+    uint64_t drops;       ///< Records dropped because the ring was full.
+    FILE * f;             ///< Binary output file.
+    pthread_t thr;        ///< Writer thread.
+    char file[MAXPATHLEN];
+    uint8_t buf[QLOG_RING_LEN];
+};
+
+#pragma clang diagnostic pop
+
+
+static void __attribute__((nonnull))
+ring_put(struct qlog_ring * const r,
+         const uint8_t * const rec,
+         const size_t len)
+{
+    const uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    const uint64_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (unlikely(QLOG_RING_LEN - (head - tail) < len)) {
+        // never block the event loop on the writer
+        r->drops++;
+        return;
+    }
+
+    const size_t pos = head & (QLOG_RING_LEN - 1);
+    const size_t n = MIN(len, QLOG_RING_LEN - pos);
+    memcpy(&r->buf[pos], rec, n);
+    memcpy(r->buf, rec + n, len - n);
+    atomic_store_explicit(&r->head, head + len, memory_order_release);
+}
+
+
+static size_t __attribute__((nonnull)) ring_drain(struct qlog_ring * const r)
+{
+    const uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    const uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (head == tail)
+        return 0;
+
+    const size_t pos = tail & (QLOG_RING_LEN - 1);
+    const size_t n = MIN(head - tail, QLOG_RING_LEN - pos);
+    if (unlikely(fwrite(&r->buf[pos], 1, n, r->f) != n))
+        warn(ERR, "could not write %s: %s", r->file, strerror(errno));
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+    return n;
+}
+
+
+static void * __attribute__((nonnull)) writer(void * const arg)
+{
+    struct qlog_ring * const r = arg;
+    while (atomic_load_explicit(&r->stop, memory_order_acquire) == false)
+        if (ring_drain(r) == 0)
+            nanosleep(&(struct timespec){.tv_nsec = QLOG_IDLE_NS}, 0);
+
+    // drain whatever is left
+    while (ring_drain(r))
+        ;
+    return 0;
+}
+
+
+void qlog_engine_init(struct w_engine * const w)
+{
+    struct qlog_ring * const r = calloc(1, sizeof(*r));
+    ensure(r, "could not calloc");
+
+    // several engines may share a process (and a qlog_dir)
+    static _Atomic uint32_t engines;
+    snprintf(r->file, sizeof(r->file), "%s/%s.%d.%" PRIu32 ".qlb",
+             ped(w)->conf.qlog_dir, quant_name, getpid(),
+             atomic_fetch_add_explicit(&engines, 1, memory_order_relaxed));
+    r->f = fopen(r->file, "we");
+    if (unlikely(r->f == 0)) {
+        warn(ERR, "could not fopen %s: %s", r->file, strerror(errno));
+        free(r);
+        return;
+    }
+
+    struct qlog_bin_hdr hdr = {.magic = QLOG_BIN_MAGIC, .vers = QLOG_BIN_VERS};
+    snprintf(hdr.producer, sizeof(hdr.producer), "%s %s", quant_name,
+             quant_version);
+    fwrite(&hdr, sizeof(hdr), 1, r->f);
+
+    r->cats = Q_QLOG_ALL;
+    r->have_thr = pthread_create(&r->thr, 0, writer, r) == 0;
+    if (unlikely(r->have_thr == false))
+        warn(WRN, "no qlog writer thread, draining when idle");
+
+    ped(w)->qlog = r;
+    warn(DBG, "binary qlog file is %s, convert with qlog2json", r->file);
+}
+
+
+void qlog_engine_close(struct w_engine * const w)
+{
+    struct qlog_ring * const r = ped(w)->qlog;
+    if (r == 0)
+        return;
+
+    if (r->have_thr) {
+        atomic_store_explicit(&r->stop, true, memory_order_release);
+        pthread_join(r->thr, 0);
+    } else
+        while (ring_drain(r))
+            ;
+
+    if (r->drops)
+        warn(WRN, "dropped %" PRIu64 " qlog records, ring full", r->drops);
+    fclose(r->f);
+    free(r);
+    ped(w)->qlog = 0;
+}
+
+
+void qlog_idle(struct w_engine * const w)
+{
+    struct qlog_ring * const r = ped(w)->qlog;
+    if (r && r->have_thr == false) {
+        ring_drain(r);
+        fflush(r->f);
+    }
+}
+
+
+static uint8_t * __attribute__((nonnull))
+rec_start(uint8_t * const buf,
+          const struct q_conn * const c,
+          const qlog_rec_t type,
+          const uint8_t evt,
+          const char * const trg)
+{
+    struct qlog_rec * const rec = (struct qlog_rec *)(void *)buf;
+    *rec = (struct qlog_rec){.t = w_now(),
+                             .id = c->qlog_id,
+                             .type = (uint8_t)type,
+                             .evt = evt,
+                             .trg_len = (uint8_t)strnlen(trg, UINT8_MAX)};
+    memcpy(buf + sizeof(*rec), trg, rec->trg_len);
+    return buf + sizeof(*rec) + rec->trg_len;
+}
+
+
+static void __attribute__((nonnull))
+rec_end(const struct q_conn * const c,
+        uint8_t * const buf,
+        const uint8_t * const end)
+{
+    struct qlog_rec * const rec = (struct qlog_rec *)(void *)buf;
+    rec->len = (uint16_t)(end - buf);
+    ring_put(ped(c->w)->qlog, buf, rec->len);
+}
+
+
+static bool __attribute__((nonnull))
+active(const struct q_conn * const c, const uint8_t cat)
+{
+    return c->qlog_id && ped(c->w)->qlog && (ped(c->w)->qlog->cats & cat);
+}
+
+
+static uint8_t __attribute__((const, nonnull))
+qlog_pkt_type(const uint8_t flags, const void * const vers)
 {
     if (is_lh(flags)) {
         if (((const uint8_t * const)vers)[0] == 0 &&
             ((const uint8_t * const)vers)[1] == 0 &&
             ((const uint8_t * const)vers)[2] == 0 &&
             ((const uint8_t * const)vers)[3] == 0)
-            return "version_negotiation";
+            return qp_vneg;
         switch (pkt_type(flags)) {
         case LH_INIT:
-            return "initial";
+            return qp_init;
         case LH_RTRY:
-            return "retry";
+            return qp_rtry;
         case LH_HSHK:
-            return "handshake";
+            return qp_hshk;
         case LH_0RTT:
-            return "zerortt";
+            return qp_0rtt;
         }
     } else if (pkt_type(flags) == SH)
-        return "onertt";
-    return "unknown";
+        return qp_1rtt;
+    return qp_unknown;
 }
 
 
-static void qlog_common(struct q_conn * const c)
+void qlog_set_filter(struct w_engine * const w,
+                     const struct q_qlog_filter * const f)
 {
-    const uint64_t now = w_now();
-    fprintf(c->qlog, "%s[%" PRIu64, likely(c->qlog_last_t) ? "," : "",
-            NS_TO_US(now - c->qlog_last_t));
-    c->qlog_last_t = now;
+    struct qlog_ring * const r = ped(w)->qlog;
+    if (r == 0) {
+        warn(WRN, "qlog not enabled, ignoring filter");
+        return;
+    }
+
+    r->cats = Q_QLOG_ALL;
+    r->sample = r->seen = 0;
+    r->cid_len = 0;
+    r->peer.addr.af = 0;
+    if (f == 0)
+        return;
+
+    if (f->categories)
+        r->cats = f->categories & Q_QLOG_ALL;
+    r->sample = f->sample;
+    r->cid_len = MIN(f->cid_prefix_len, sizeof(r->cid));
+    memcpy(r->cid, f->cid_prefix, r->cid_len);
+    if (f->peer && w_to_waddr(&r->peer.addr, f->peer))
+        r->peer.port =
+            f->peer->sa_family == AF_INET
+                ? ((const struct sockaddr_in *)(const void *)f->peer)->sin_port
+                : ((const struct sockaddr_in6 *)(const void *)f->peer)
+                      ->sin6_port;
 }
 
 
-void qlog_init(struct q_conn * const c)
+static bool __attribute__((nonnull))
+cid_match(const struct qlog_ring * const r, const struct cid * const id)
 {
-    // remove existing file and create new one; this happens during vneg
-    if (c->qlog) {
-        remove(c->qlog_file);
-        c->qlog_last_t = 0;
-        c->qlog = 0;
-    }
+    return id->len >= r->cid_len && memcmp(id->id, r->cid, r->cid_len) == 0;
+}
+
+
+static bool __attribute__((nonnull))
+want_conn(struct qlog_ring * const r, const struct q_conn * const c)
+{
+    if (r->cid_len && (c->scid == 0 || cid_match(r, c->scid) == false) &&
+        (c->dcid == 0 || cid_match(r, c->dcid) == false))
+        return false;
+
+    if (r->peer.addr.af &&
+        (w_addr_cmp(&r->peer.addr, &c->peer.addr) == false ||
+         (r->peer.port && r->peer.port != c->peer.port)))
+        return false;
+
+    // sample last, so that only matching conns count towards it
+    return r->sample <= 1 || r->seen++ % r->sample == 0;
+}
+
+
+static void __attribute__((nonnull))
+qlog_open(struct qlog_ring * const r, struct q_conn * const c)
+{
+    // a restart (during vneg) reuses the id, qlog2json starts over
+    if (c->qlog_id == 0)
+        c->qlog_id = ++r->next_id;
 
-    snprintf(c->qlog_file, sizeof(c->qlog_file), "%s/%s.%s.qlog",
-             ped(c->w)->conf.qlog_dir,
+    char name[hex_str_len(CID_LEN_MAX) + 8];
+    snprintf(name, sizeof(name), "%s.%s",
              is_clnt(c) ? hex2str(c->dcid->id, c->dcid->len,
                                   (char[hex_str_len(CID_LEN_MAX)]){""},
                                   hex_str_len(CID_LEN_MAX))
@@ -100,34 +334,53 @@ void qlog_init(struct q_conn * const c)
                                   (char[hex_str_len(CID_LEN_MAX)]){""},
                                   hex_str_len(CID_LEN_MAX)),
              is_clnt(c) ? "clnt" : "serv");
+    char gid[hex_str_len(CID_LEN_MAX)];
+    hex2str(c->dcid->id, c->dcid->len, gid, sizeof(gid));
+
+    uint8_t buf[QLOG_REC_MAX];
+    uint8_t * pos = rec_start(buf, c, qr_open, 0, "");
+    const struct qlog_rec_open o = {.is_clnt = is_clnt(c),
+                                    .name_len = (uint8_t)strlen(name),
+                                    .gid_len = (uint8_t)strlen(gid)};
+    memcpy(pos, &o, sizeof(o));
+    pos += sizeof(o);
+    memcpy(pos, name, o.name_len);
+    pos += o.name_len;
+    memcpy(pos, gid, o.gid_len);
+    pos += o.gid_len;
+    rec_end(c, buf, pos);
+}
+
 
-    c->qlog = fopen(c->qlog_file, "we");
-    warn(DBG, "qlog file is %s", c->qlog_file);
-    if (unlikely(c->qlog == 0)) {
-        warn(ERR, "could not fopen %s: %s", c->qlog_file, strerror(errno));
+void qlog_init(struct q_conn * const c)
+{
+    struct qlog_ring * const r = ped(c->w)->qlog;
+    if (r && (c->qlog_id || want_conn(r, c)))
+        qlog_open(r, c);
+}
+
+
+void qlog_conn(struct q_conn * const c, const bool enable)
+{
+    struct qlog_ring * const r = ped(c->w)->qlog;
+    if (r == 0)
         return;
-    }
 
-    fprintf(c->qlog,
-            "{\"qlog_version\":\"draft-01\",\"title\":\"%s %s "
-            "qlog\",\"traces\":[{\"vantage_point\":{\"type\":\"%s\"},"
-            "\"configuration\":{\"time_units\":\"us\"},\"common_fields\":{"
-            "\"group_id\":\"%s\",\"protocol_type\":\"QUIC_HTTP3\"},\"event_"
-            "fields\":[\"delta_time\",\"category\","
-            "\"event\",\"trigger\",\"data\"],\"events\":[",
-            quant_name, quant_version, is_clnt(c) ? "client" : "server",
-            hex2str(c->dcid->id, c->dcid->len,
-                    (char[hex_str_len(CID_LEN_MAX)]){""},
-                    hex_str_len(CID_LEN_MAX)));
+    if (enable && c->qlog_id == 0)
+        qlog_open(r, c);
+    else if (enable == false)
+        qlog_close(c);
 }
 
 
 void qlog_close(struct q_conn * const c)
 {
-    if (c->qlog) {
-        fputs("]}]}", c->qlog);
-        fclose(c->qlog);
-    }
+    if (c->qlog_id == 0 || ped(c->w)->qlog == 0)
+        return;
+
+    uint8_t buf[sizeof(struct qlog_rec)];
+    rec_end(c, buf, rec_start(buf, c, qr_close, 0, ""));
+    c->qlog_id = 0;
 }
 
 
@@ -140,103 +393,82 @@ void qlog_transport(const qlog_pkt_evt_t evt,
         return;
 
     struct q_conn * const c = m->pn->c;
-
-    if (c->qlog == 0)
+    if (active(c, Q_QLOG_TRANSPORT) == false)
         return;
 
-    qlog_common(c);
+    uint8_t buf[QLOG_REC_MAX];
+    uint8_t * pos = rec_start(buf, c, qr_transport, (uint8_t)evt, trg);
 
-    static const char * const evt_str[] = {[pkt_tx] = "packet_sent",
-                                           [pkt_rx] = "packet_received",
-                                           [pkt_dp] = "packet_dropped"};
-    fprintf(c->qlog,
-            ",\"transport\",\"%s\",\"%s\",{\"packet_type\":\"%s\",\"header\":{"
-            "\"packet_size\":%u",
-            evt_str[evt], trg, qlog_pkt_type_str(m->hdr.flags, &m->hdr.vers),
-            m->udp_len);
-    if (is_lh(m->hdr.flags) == false || (m->hdr.vers && m->hdr.type != LH_RTRY))
-        fprintf(c->qlog, ",\"packet_number\":%" PRIu, m->hdr.nr);
-    fputs("}", c->qlog);
+    struct qlog_rec_pkt p = {
+        .pkt_type = qlog_pkt_type(m->hdr.flags, &m->hdr.vers),
+        .udp_len = m->udp_len,
+        .nr = m->hdr.nr,
+        .has_nr = is_lh(m->hdr.flags) == false ||
+                  (m->hdr.vers && m->hdr.type != LH_RTRY)};
+    uint8_t * const p_pos = pos;
+    pos += sizeof(p);
 
     if (evt == pkt_dp)
         goto done;
 
-    static const struct frames qlog_frm =
-        bitset_t_initializer(1 << FRM_ACK | 1 << FRM_STR);
-    if (bit_overlap(FRM_MAX, &m->frms, &qlog_frm) == false)
-        goto done;
-
-    fputs(",\"frames\":[", c->qlog);
-    int prev_frame = 0;
     if (has_frm(m->frms, FRM_STR)) {
-        prev_frame = fprintf(c->qlog,
-                             "%s{\"frame_type\":\"stream\",\"stream_id\":%" PRId
-                             ",\"length\":%u,\"offset\":%" PRIu,
-                             /* prev_frame ? "," : */ "", m->strm->id,
-                             m->strm_data_len, m->strm_off);
-        if (m->is_fin)
-            fputs(",\"fin\":true", c->qlog);
-        fputs("}", c->qlog);
+        p.has_strm = true;
+        p.sid = m->strm->id;
+        p.strm_len = m->strm_data_len;
+        p.strm_off = m->strm_off;
+        p.fin = m->is_fin;
     }
 
     if (has_frm(m->frms, FRM_ACK)) {
+        p.has_ack = true;
         adj_iov_to_start(v, m);
-        const uint8_t * pos = v->buf + m->ack_frm_pos;
+        const uint8_t * dec = v->buf + m->ack_frm_pos;
         const uint8_t * const end = v->buf + v->len;
 
         uint64_t lg_ack = 0;
-        decv(&lg_ack, &pos, end);
-        uint64_t ack_delay = 0;
-        decv(&ack_delay, &pos, end);
+        decv(&lg_ack, &dec, end);
+        decv(&p.ack_delay, &dec, end);
         uint64_t ack_rng_cnt = 0;
-        decv(&ack_rng_cnt, &pos, end);
-
-        // prev_frame =
-        fprintf(c->qlog,
-                "%s{\"frame_type\":\"ack\",\"ack_delay\":%" PRIu64
-                ",\"acked_ranges\":[",
-                prev_frame ? "," : "", ack_delay);
+        decv(&ack_rng_cnt, &dec, end);
 
         // this is a similar loop as in dec_ack_frame() - keep changes in sync
-        for (uint64_t n = ack_rng_cnt + 1; n > 0; n--) {
+        for (uint64_t n = ack_rng_cnt + 1;
+             n > 0 && p.ack_rng_cnt < QLOG_ACK_RNG_MAX; n--) {
             uint64_t ack_rng = 0;
-            decv(&ack_rng, &pos, end);
-            fprintf(c->qlog, "%s[%" PRIu64 ",%" PRIu64 "]",
-                    (n <= ack_rng_cnt ? "," : ""), lg_ack - ack_rng, lg_ack);
+            decv(&ack_rng, &dec, end);
+            const uint64_t rng[2] = {lg_ack - ack_rng, lg_ack};
+            memcpy(pos, rng, sizeof(rng));
+            pos += sizeof(rng);
+            p.ack_rng_cnt++;
             if (n > 1) {
                 uint64_t gap = 0;
-                decv(&gap, &pos, end);
+                decv(&gap, &dec, end);
                 lg_ack -= ack_rng + gap + 2;
             }
         }
-
         adj_iov_to_data(v, m);
-        fputs("]}", c->qlog);
     }
-    fputs("]", c->qlog);
 
 done:
-    fputs("}]", c->qlog);
+    memcpy(p_pos, &p, sizeof(p));
+    rec_end(c, buf, pos);
 }
 
+
 void qlog_timers(const qlog_tim_evt_t evt,
                  const char * const trg,
                  struct q_conn * const c,
                  const double timer)
 {
-    if (c->qlog == 0)
+    if (active(c, Q_QLOG_TIMERS) == false)
         return;
 
-    qlog_common(c);
-
-    static const char * const evt_str[] = {
-        [tim_ack] = "rack_timer", [tim_prb] = "probe_timer"};
-    fprintf(c->qlog, ",\"recovery\",\"%s\",\"%s\",{", evt_str[evt], trg);
-
-    fprintf(c->qlog, "\"timer\":%f", timer);
-
-done:
-    fputs("}]", c->qlog);
+    uint8_t buf[QLOG_REC_MAX];
+    uint8_t * pos = rec_start(buf, c, qr_timers, (uint8_t)evt, trg);
+    const struct qlog_rec_tim t = {.timer = timer};
+    memcpy(pos, &t, sizeof(t));
+    pos += sizeof(t);
+    rec_end(c, buf, pos);
 }
 
 
@@ -245,60 +477,50 @@ void qlog_recovery(const qlog_rec_evt_t evt,
                    struct q_conn * const c,
                    const struct pkt_meta * const m)
 {
-    if (c->qlog == 0)
+    if (active(c, Q_QLOG_RECOVERY) == false)
         return;
 
-    qlog_common(c);
-
-    static const char * const evt_str[] = {
-        [rec_mu] = "metrics_updated", [rec_pl] = "packet_lost"};
-    fprintf(c->qlog, ",\"recovery\",\"%s\",\"%s\",{", evt_str[evt], trg);
+    uint8_t buf[QLOG_REC_MAX];
+    uint8_t * pos = rec_start(buf, c, qr_recovery, (uint8_t)evt, trg);
+    struct qlog_rec_rec r = {0};
 
     if (evt == rec_pl) {
-        if (m->loss_trigger == 3)
-            fprintf(c->qlog, "\"trigger\":\"pto_expired\"");
-        else {
-            fprintf(c->qlog, "\"packet_number\":%" PRIu, m->hdr.nr);
-            if (m->loss_trigger == 1)
-                fprintf(c->qlog, ",\"trigger\":\"time_threshold\"");
-            if (m->loss_trigger == 2)
-                fprintf(c->qlog, ",\"trigger\":\"packet_threshold\"");   
-        }
+        r.loss_trigger = m->loss_trigger;
+        r.nr = m->hdr.nr;
         goto done;
     }
 
-    int prev_metric = 0;
-    if (c->rec.cur.in_flight != c->rec.prev.in_flight)
-        prev_metric =
-            fprintf(c->qlog, "%s\"bytes_in_flight\":%" PRIu,
-                    /* prev_metric ? "," : */ "", c->rec.cur.in_flight);
-    if (c->rec.cur.cwnd != c->rec.prev.cwnd)
-        prev_metric = fprintf(c->qlog, "%s\"cwnd\":%" PRIu,
-                              prev_metric ? "," : "", c->rec.cur.cwnd);
-#if 0
-    if (c->rec.cur.ssthresh != UINT_T_MAX &&
-        c->rec.cur.ssthresh != c->rec.prev.ssthresh)
-        prev_metric = fprintf(c->qlog, "%s\"ssthresh\":%" PRIu,
-                              prev_metric ? "," : "", c->rec.cur.ssthresh);
-#endif
-    if (c->rec.cur.srtt != c->rec.prev.srtt)
-        prev_metric = fprintf(c->qlog, "%s\"smoothed_rtt\":%" PRIu,
-                              prev_metric ? "," : "", c->rec.cur.srtt);
-    if (c->rec.cur.min_rtt < UINT_T_MAX &&
-        c->rec.cur.min_rtt != c->rec.prev.min_rtt)
-        prev_metric = fprintf(c->qlog, "%s\"min_rtt\":%" PRIu,
-                              prev_metric ? "," : "", c->rec.cur.min_rtt);
-    if (c->rec.cur.latest_rtt != c->rec.prev.latest_rtt)
-        // prev_metric =
-        fprintf(c->qlog, "%s\"latest_rtt\":%" PRIu, prev_metric ? "," : "",
-                c->rec.cur.latest_rtt);
-    if (c->rec.cur.rttvar != c->rec.prev.rttvar)
-        // prev_metric =
-        fprintf(c->qlog, "%s\"rtt_variance\":%" PRIu, prev_metric ? "," : "",
-                c->rec.cur.rttvar);
+    const struct cc_state * const cur = &c->rec.cur;
+    const struct cc_state * const prev = &c->rec.prev;
+    if (cur->in_flight != prev->in_flight) {
+        r.changed |= QLOG_MU_IN_FLIGHT;
+        r.in_flight = cur->in_flight;
+    }
+    if (cur->cwnd != prev->cwnd) {
+        r.changed |= QLOG_MU_CWND;
+        r.cwnd = cur->cwnd;
+    }
+    if (cur->srtt != prev->srtt) {
+        r.changed |= QLOG_MU_SRTT;
+        r.srtt = cur->srtt;
+    }
+    if (cur->min_rtt < UINT_T_MAX && cur->min_rtt != prev->min_rtt) {
+        r.changed |= QLOG_MU_MIN_RTT;
+        r.min_rtt = cur->min_rtt;
+    }
+    if (cur->latest_rtt != prev->latest_rtt) {
+        r.changed |= QLOG_MU_LATEST_RTT;
+        r.latest_rtt = cur->latest_rtt;
+    }
+    if (cur->rttvar != prev->rttvar) {
+        r.changed |= QLOG_MU_RTTVAR;
+        r.rttvar = cur->rttvar;
+    }
 
 done:
-    fputs("}]", c->qlog);
+    memcpy(pos, &r, sizeof(r));
+    pos += sizeof(r);
+    rec_end(c, buf, pos);
 }
 
 #else
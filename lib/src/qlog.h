@@ -27,24 +27,48 @@
 
 #pragma once
 
+// the event enums are also needed by qlog2json, which decodes the binary log
+typedef enum { pkt_tx, pkt_rx, pkt_dp } qlog_pkt_evt_t;
+
+typedef enum { rec_mu, rec_pl } qlog_rec_evt_t;
+
+typedef enum { tim_ack, tim_prb } qlog_tim_evt_t;
+
+
 #ifndef NO_QLOG
 
-struct pkt_meta; // IWYU pragma: no_forward_declare pkt_meta
-struct q_conn;   // IWYU pragma: no_forward_declare q_conn
-struct w_iov;    // IWYU pragma: no_forward_declare w_iov
+#include <stdbool.h>
+
+struct pkt_meta;      // IWYU pragma: no_forward_declare pkt_meta
+struct q_conn;        // IWYU pragma: no_forward_declare q_conn
+struct q_qlog_filter; // IWYU pragma: no_forward_declare q_qlog_filter
+struct w_engine;      // IWYU pragma: no_forward_declare w_engine
+struct w_iov;         // IWYU pragma: no_forward_declare w_iov
 
 // IWYU pragma: no_include <warpcore/warpcore.h>
 // IWYU pragma: no_include "conn.h"
 // IWYU pragma: no_include "quic.h"
 
 
-typedef enum { pkt_tx, pkt_rx, pkt_dp } qlog_pkt_evt_t;
+extern void __attribute__((nonnull))
+qlog_engine_init(struct w_engine * const w);
+
+extern void __attribute__((nonnull))
+qlog_engine_close(struct w_engine * const w);
 
+extern void __attribute__((nonnull)) qlog_idle(struct w_engine * const w);
 
 extern void __attribute__((nonnull)) qlog_init(struct q_conn * const c);
 
 extern void qlog_close(struct q_conn * const c);
 
+extern void __attribute__((nonnull(1)))
+qlog_set_filter(struct w_engine * const w,
+                const struct q_qlog_filter * const f);
+
+extern void __attribute__((nonnull))
+qlog_conn(struct q_conn * const c, const bool enable);
+
 extern void __attribute__((nonnull))
 qlog_transport(const qlog_pkt_evt_t evt,
                const char * const trg,
@@ -52,16 +76,12 @@ qlog_transport(const qlog_pkt_evt_t evt,
                const struct pkt_meta * const m);
 
 
-typedef enum { rec_mu, rec_pl } qlog_rec_evt_t;
-
 extern void __attribute__((nonnull(3)))
 qlog_recovery(const qlog_rec_evt_t evt,
               const char * const trg,
               struct q_conn * const c,
               const struct pkt_meta * const m);
 
-typedef enum { tim_ack, tim_prb } qlog_tim_evt_t;
-
 extern void __attribute__((nonnull(3)))
 qlog_timers(const qlog_tim_evt_t evt,
             const char * const trg,
@@ -86,5 +106,21 @@ qlog_timers(const qlog_tim_evt_t evt,
     do {                                                                       \
     } while (0)
 
+#define qlog_timers(...)                                                       \
+    do {                                                                       \
+    } while (0)
+
+#define qlog_engine_init(...)                                                  \
+    do {                                                                       \
+    } while (0)
+
+#define qlog_engine_close(...)                                                 \
+    do {                                                                       \
+    } while (0)
+
+#define qlog_idle(...)                                                         \
+    do {                                                                       \
+    } while (0)
+
 
 #endif
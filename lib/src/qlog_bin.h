@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// Binary qlog record format, shared between the library and qlog2json. All
+// fields are in host byte order; files are meant to be converted on the
+// machine (or at least the architecture) that produced them.
+
+#include <stdint.h>
+
+
+#define QLOG_BIN_MAGIC 0x62676f6c71 ///< "qlogb"
+#define QLOG_BIN_VERS 1
+#define QLOG_ACK_RNG_MAX 32 ///< ACK ranges recorded per packet, at most.
+
+
+/// File header.
+struct qlog_bin_hdr {
+    uint64_t magic;
+    uint16_t vers;
+    uint8_t _unused[6];
+    char producer[32]; ///< Implementation name and version.
+};
+
+
+typedef enum {
+    qr_open = 1,      ///< Connection started (or restarted) logging.
+    qr_close = 2,     ///< Connection stopped logging.
+    qr_transport = 3, ///< Packet event; evt is a qlog_pkt_evt_t.
+    qr_recovery = 4,  ///< Recovery event; evt is a qlog_rec_evt_t.
+    qr_timers = 5,    ///< Timer event; evt is a qlog_tim_evt_t.
+} qlog_rec_t;
+
+
+/// Every record starts with this, followed by trg_len bytes of trigger
+/// string, followed by the type-specific payload.
+struct qlog_rec {
+    uint64_t t;      ///< Absolute event time in nsec.
+    uint32_t id;     ///< Engine-unique connection number.
+    uint16_t len;    ///< Total record length, including this header.
+    uint8_t type;    ///< Record type, a qlog_rec_t.
+    uint8_t evt;     ///< Event within that type.
+    uint8_t trg_len; ///< Length of the trigger string.
+    uint8_t _unused[7];
+};
+
+
+/// Payload of qr_open, followed by name_len bytes of output file name (sans
+/// extension) and gid_len bytes of group ID.
+struct qlog_rec_open {
+    uint8_t is_clnt;
+    uint8_t name_len;
+    uint8_t gid_len;
+    uint8_t _unused[5];
+};
+
+
+typedef enum {
+    qp_vneg,
+    qp_init,
+    qp_rtry,
+    qp_hshk,
+    qp_0rtt,
+    qp_1rtt,
+    qp_unknown,
+} qlog_pkt_type_t;
+
+
+/// Payload of qr_transport, followed by ack_rng_cnt pairs of uint64_t
+/// (smallest, largest) ACK'ed packet numbers.
+struct qlog_rec_pkt {
+    uint64_t nr;
+    int64_t sid;
+    uint64_t strm_off;
+    uint64_t ack_delay;
+    uint16_t udp_len;
+    uint16_t strm_len;
+    uint8_t pkt_type; ///< A qlog_pkt_type_t.
+    uint8_t has_nr : 1;
+    uint8_t has_strm : 1;
+    uint8_t fin : 1;
+    uint8_t has_ack : 1;
+    uint8_t : 4;
+    uint8_t ack_rng_cnt;
+    uint8_t _unused;
+};
+
+
+#define QLOG_MU_IN_FLIGHT 0x01
+#define QLOG_MU_CWND 0x02
+#define QLOG_MU_SRTT 0x04
+#define QLOG_MU_MIN_RTT 0x08
+#define QLOG_MU_LATEST_RTT 0x10
+#define QLOG_MU_RTTVAR 0x20
+
+
+/// Payload of qr_recovery.
+struct qlog_rec_rec {
+    uint64_t nr;          ///< Lost packet number (packet_lost).
+    uint64_t in_flight;   ///< Metrics (metrics_updated), valid when the
+    uint64_t cwnd;        ///< corresponding QLOG_MU_* bit is set in changed.
+    uint64_t srtt;
+    uint64_t min_rtt;
+    uint64_t latest_rtt;
+    uint64_t rttvar;
+    uint8_t changed;      ///< QLOG_MU_* bitmask.
+    uint8_t loss_trigger; ///< 1 = time, 2 = packet threshold, 3 = PTO.
+    uint8_t _unused[6];
+};
+
+
+/// Payload of qr_timers.
+struct qlog_rec_tim {
+    double timer;
+};
@@ -30,6 +30,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 
 #include <picotls.h>
@@ -48,15 +49,23 @@
 #include <arpa/inet.h>
 #endif
 
+#ifdef HAVE_REUSEPORT_CBPF
+#include <errno.h>
+#include <linux/filter.h>
+#endif
+
 #include "conn.h"
+#include "lb.h"
 #include "loop.h"
 #include "pkt.h"
 #include "pn.h"
+#include "qlog.h"
 #include "quic.h"
 #include "recovery.h"
 #include "stream.h"
 #include "tls.h"
 #include "tree.h"
+#include "uring.h"
 
 
 char __srt_str[hex_str_len(SRT_LEN)];
@@ -148,6 +157,37 @@ void free_iov(struct w_iov * const v, struct pkt_meta * const m)
 }
 
 
+void socks_by_fd_ins(struct w_sock * const ws)
+{
+    struct per_engine_data * const ped = ped(ws->w);
+    int ret;
+    const khiter_t k = kh_put(socks_by_fd, &ped->socks_by_fd, w_fd(ws), &ret);
+    ensure(ret >= 1, "inserted returned %d", ret);
+    kh_val(&ped->socks_by_fd, k) = ws;
+#ifdef HAVE_LIBURING
+    if (ped->uring)
+        uring_add_sock(ws);
+#endif
+}
+
+
+void socks_by_fd_del(struct w_sock * const ws)
+{
+    struct per_engine_data * const ped = ped(ws->w);
+    const khiter_t k = kh_get(socks_by_fd, &ped->socks_by_fd, w_fd(ws));
+    ensure(k != kh_end(&ped->socks_by_fd), "found");
+    kh_del(socks_by_fd, &ped->socks_by_fd, k);
+#ifdef HAVE_LIBURING
+    if (ped->uring)
+        uring_del_sock(ws);
+#endif
+#ifdef QUANT_NETEM
+    if (ped->netem)
+        netem_del_sock(ws);
+#endif
+}
+
+
 struct w_iov * alloc_iov(struct w_engine * const w,
                          const int af,
                          const uint16_t len,
@@ -334,6 +374,12 @@ bool q_write(struct q_stream * const s,
         return false;
     }
 
+    if (unlikely(s->src)) {
+        warn(ERR, "%s conn %s strm " FMT_SID " still has a lazy source",
+             conn_type(c), cid_str(c->scid), s->id);
+        return false;
+    }
+
     // add to stream
     if (fin) {
         if (sq_empty(q)) {
@@ -361,6 +407,31 @@ bool q_write(struct q_stream * const s,
 }
 
 
+bool q_write_fill(struct q_stream * const s,
+                  const q_fill_cb fill,
+                  void * const arg)
+{
+    // this validates the conn and stream state and kicks the TX watcher
+    struct w_iov_sq q = w_iov_sq_initializer(q);
+    if (q_write(s, &q, false) == false)
+        return false;
+
+    struct strm_src * const src = calloc(1, sizeof(*src));
+    ensure(src, "could not calloc");
+    src->fill = fill;
+    src->fill_arg = arg;
+    s->src = src;
+    s->lazy_out = true;
+    return true;
+}
+
+
+void q_resume_fill(struct q_stream * const s)
+{
+    timeouts_add(ped(s->c->w)->wheel, &s->c->tx_w, 0);
+}
+
+
 static struct q_stream * __attribute__((nonnull))
 find_ready_strm(khash_t(strms_by_id) * const sbi, const bool all)
 {
@@ -462,6 +533,58 @@ struct q_conn * q_bind(struct w_engine * const w
 }
 
 
+// Workers must bind the SO_REUSEPORT group of c in the order of their one-byte
+// plaintext QUIC-LB server IDs. Short-header pkts then reach the worker named
+// in their DCID; long-header pkts are hashed by four-tuple by the kernel.
+bool q_reuseport_steer(const struct q_conn * const c
+#ifndef HAVE_REUSEPORT_CBPF
+                       __attribute__((unused))
+#endif
+                       ,
+                       const uint8_t workers
+#ifndef HAVE_REUSEPORT_CBPF
+                       __attribute__((unused))
+#endif
+)
+{
+#ifdef HAVE_REUSEPORT_CBPF
+    const struct q_lb * const lb = ped(c->w)->lb;
+    if (unlikely(lb == 0 || lb_is_plain(lb) == false || workers == 0)) {
+        warn(ERR, "steering needs plaintext QUIC-LB server IDs");
+        return false;
+    }
+
+    // the returned index selects the socket; an out-of-range index (or a
+    // packet too short to load from) makes the kernel hash the four-tuple
+    struct sock_filter code[] = {
+        // A = first byte of the QUIC header
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+        // long header?
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, HEAD_FORM, 3, 0),
+        // A = first server ID byte, after the type byte and the CID octet
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 2),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, workers),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+        BPF_STMT(BPF_RET | BPF_K, UINT32_MAX)};
+    const struct sock_fprog prog = {.len = sizeof(code) / sizeof(code[0]),
+                                    .filter = code};
+
+    if (unlikely(setsockopt(w_fd(c->sock), SOL_SOCKET,
+                            SO_ATTACH_REUSEPORT_CBPF, &prog,
+                            sizeof(prog)) != 0)) {
+        warn(ERR, "cannot attach SO_REUSEPORT program: %s", strerror(errno));
+        return false;
+    }
+    warn(INF, "steering short-header pkts on port %u between %u workers",
+         bswap16(c->sock->ws_lport), workers);
+    return true;
+#else
+    warn(ERR, "SO_REUSEPORT steering not supported on this platform");
+    return false;
+#endif
+}
+
+
 static void cancel_api_call(struct timeout * const api_alarm)
 {
 #ifdef DEBUG_EXTRA
@@ -517,6 +640,7 @@ struct q_conn * q_accept(struct w_engine * const w
 accept:;
     struct q_conn * const c = sl_first(&accept_queue);
     sl_remove_head(&accept_queue, node_aq);
+    ped(w)->aq_len--;
     restart_idle_alarm(c);
     c->needs_accept = false;
 
@@ -610,6 +734,34 @@ struct w_engine * q_init(const char * const ifname,
             MIN(ped(w)->conf.server_cid_len, CID_LEN_MAX);
     else
         ped(w)->conf.server_cid_len = 4; // could be another value
+    if (conf && conf->lb) {
+        ped(w)->lb = q_lb_new(conf->lb);
+        ensure(ped(w)->lb, "invalid QUIC-LB config");
+        ped(w)->conf.server_cid_len = lb_cid_len(ped(w)->lb);
+        if (ped(w)->conf.enable_cid_slots) {
+            // both want to own the leading CID bytes
+            warn(WRN, "CID slots cannot be used with QUIC-LB, disabling");
+            ped(w)->conf.enable_cid_slots = false;
+        }
+    }
+#ifndef NO_MIGRATION
+    if (ped(w)->conf.enable_cid_slots &&
+        ped(w)->conf.server_cid_len < CID_SLOT_MIN_LEN) {
+        // the part of the CID after the slot index must be hard to guess
+        warn(WRN, "CID slots need %u-byte server CIDs, was %u",
+             CID_SLOT_MIN_LEN, ped(w)->conf.server_cid_len);
+        ped(w)->conf.server_cid_len = CID_SLOT_MIN_LEN;
+    }
+#else
+    ped(w)->conf.enable_cid_slots = false;
+#endif
+#ifndef HAVE_W_REUSEPORT
+    if (ped(w)->conf.enable_reuseport) {
+        warn(WRN, "%s built with a warpcore lacking SO_REUSEPORT, disabling",
+             quant_name);
+        ped(w)->conf.enable_reuseport = false;
+    }
+#endif
 
     ped(w)->default_conn_conf =
         (struct q_conn_conf){.initial_rtt = 500,
@@ -651,6 +803,7 @@ struct w_engine * q_init(const char * const ifname,
     // initialize some globals
 #ifndef NO_MIGRATION
     memset(&conns_by_id, 0, sizeof(conns_by_id));
+    memset(&cid_slots, 0, sizeof(cid_slots));
 #endif
 #ifndef NO_SRT_MATCHING
     memset(&conns_by_srt, 0, sizeof(conns_by_srt));
@@ -671,6 +824,30 @@ struct w_engine * q_init(const char * const ifname,
     // initialize TLS context
     init_tls_ctx(conf, ped(w));
 
+    if (ped(w)->conf.qlog_dir)
+        qlog_engine_init(w);
+
+    if (conf && conf->tls_sign_threads) {
+#ifdef HAVE_ASYNC_SIGN
+        sign_pool_init(w, conf->tls_sign_threads);
+#else
+        warn(WRN, "%s built without async TLS signing, signing inline",
+             quant_name);
+#endif
+    }
+
+    if (conf && conf->enable_io_uring) {
+#ifdef HAVE_LIBURING
+        if (strcmp(w->backend_name, "netmap") == 0)
+            warn(WRN, "io_uring unsupported with %s backend", w->backend_name);
+        else if (uring_init(w) == false)
+            warn(WRN, "io_uring unavailable, using %s", w->backend_name);
+#else
+        warn(WRN, "%s built without liburing, using %s", quant_name,
+             w->backend_name);
+#endif
+    }
+
 #if !defined(NDEBUG) && defined(FUZZER_CORPUS_COLLECTION)
 #ifdef FUZZING
     warn(CRT, "%s compiled for fuzzing - will not communicate", quant_name);
@@ -852,6 +1029,9 @@ void q_cleanup(struct w_engine * const w)
     struct q_conn * c;
 #ifndef NO_MIGRATION
     kh_foreach_value(&conns_by_id, c, { q_close(c, 0, 0); });
+    for (size_t i = 0; i < kv_size(cid_slots.s); i++)
+        if (kv_A(cid_slots.s, i).c)
+            q_close(kv_A(cid_slots.s, i).c, 0, 0);
 #else
 #endif
 
@@ -868,9 +1048,27 @@ void q_cleanup(struct w_engine * const w)
         q_close(c, 0, 0);
 #endif
 
+#ifdef HAVE_ASYNC_SIGN
+    if (ped(w)->sign)
+        sign_pool_close(w);
+#endif
+
     // stop the event loop
     timeouts_close(ped(w)->wheel);
 
+    // all conns are closed, flush their qlog records
+    qlog_engine_close(w);
+
+#ifdef HAVE_LIBURING
+    if (ped(w)->uring)
+        uring_cleanup(w);
+#endif
+
+#ifdef QUANT_NETEM
+    if (ped(w)->netem)
+        netem_detach(w);
+#endif
+
 #ifndef NO_OOO_0RTT
     // free 0-RTT reordering cache
     while (!splay_empty(&ooo_0rtt_by_cid)) {
@@ -895,6 +1093,8 @@ void q_cleanup(struct w_engine * const w)
 
 #ifndef NO_MIGRATION
     kh_release(conns_by_id, &conns_by_id);
+    kv_destroy(cid_slots.s);
+    kv_destroy(cid_slots.free);
 #endif
 #ifndef NO_SRT_MATCHING
     kh_release(conns_by_srt, &conns_by_srt);
@@ -903,7 +1103,12 @@ void q_cleanup(struct w_engine * const w)
 #ifndef NO_SERVER
     kv_destroy(ped(w)->serv_socks);
 #endif
+    kv_destroy(ped(w)->events);
+    kh_release(socks_by_fd, &ped(w)->socks_by_fd);
 
+    prof_dump(w);
+    if (ped(w)->lb)
+        q_lb_free(ped(w)->lb);
     free_tls_ctx(ped(w));
     free(ped(w)->pkt_meta);
     free(w->data);
@@ -1022,7 +1227,7 @@ bool q_ready(struct w_engine * const w,
     *ready = c;
 done:
 #ifndef NO_MIGRATION
-    return kh_size(&conns_by_id);
+    return kh_size(&conns_by_id) + cid_slots.cnt;
 #else
     return sl_empty(&ped(w)->conns);
 #endif
@@ -1049,6 +1254,128 @@ int q_conn_af(const struct q_conn * const c)
 }
 
 
+void q_set_event_cb(struct w_engine * const w,
+                    const q_event_cb cb,
+                    void * const arg)
+{
+    ped(w)->event_cb = cb;
+    ped(w)->event_arg = arg;
+    if (cb == 0)
+        kv_size(ped(w)->events) = 0;
+}
+
+
+#ifndef NO_QLOG
+void q_set_qlog_filter(struct w_engine * const w,
+                       const struct q_qlog_filter * const f)
+{
+    qlog_set_filter(w, f);
+}
+
+
+void q_qlog_conn(struct q_conn * const c, const bool enable)
+{
+    qlog_conn(c, enable);
+}
+#endif
+
+
+#ifdef QUANT_NETEM
+void q_netem_attach(struct w_engine * const w,
+                    const struct q_netem_conf * const conf)
+{
+    netem_attach(w, conf);
+}
+
+
+void q_netem_detach(struct w_engine * const w)
+{
+    if (ped(w)->netem)
+        netem_detach(w);
+}
+
+
+uint64_t q_netem_now(void)
+{
+    return w_now();
+}
+#endif
+
+
+uint32_t q_process(struct w_engine * const w, const uint64_t nsec)
+{
+    ensure(api_func == 0, "cannot be called while blocking API call active");
+
+    // run (at most) one event loop iteration, waiting up to nsec for RX
+    loop_init();
+    loop_once(w, nsec);
+
+    return ped(w)->event_cb ? loop_event_deliver(w) : 0;
+}
+
+
+uint64_t q_next_timeout(struct w_engine * const w)
+{
+    timeouts_update(ped(w)->wheel, w_now());
+    return timeouts_timeout(ped(w)->wheel);
+}
+
+
+uint32_t q_get_fds(struct w_engine * const w,
+                   int * const fds,
+                   const uint32_t fds_len)
+{
+#ifdef HAVE_LIBURING
+    if (ped(w)->uring) {
+        // all sockets are serviced through the ring
+        if (fds_len)
+            fds[0] = uring_fd(w);
+        return 1;
+    }
+#endif
+
+    uint32_t n = 0;
+    struct w_sock * ws;
+    kh_foreach_value(&ped(w)->socks_by_fd, ws, {
+        if (n < fds_len)
+            fds[n] = w_fd(ws);
+        n++;
+    });
+    return n;
+}
+
+
+uint32_t q_on_timeout(struct w_engine * const w)
+{
+    ensure(api_func == 0, "cannot be called while blocking API call active");
+    loop_init();
+    loop_timers(w);
+    return ped(w)->event_cb ? loop_event_deliver(w) : 0;
+}
+
+
+uint32_t q_on_readable(struct w_engine * const w, const int fd)
+{
+    ensure(api_func == 0, "cannot be called while blocking API call active");
+    loop_init();
+
+    const khiter_t k = kh_get(socks_by_fd, &ped(w)->socks_by_fd, fd);
+    if (likely(k != kh_end(&ped(w)->socks_by_fd))
+#ifdef HAVE_LIBURING
+        && ped(w)->uring == 0
+#endif
+    ) {
+        timeouts_update(ped(w)->wheel, w_now());
+        rx(kh_val(&ped(w)->socks_by_fd, k));
+    } else
+        // not one of our sockets (e.g., a netmap engine fd or the io_uring
+        // fd), do a full RX pass
+        loop_rx(w, 0);
+
+    return ped(w)->event_cb ? loop_event_deliver(w) : 0;
+}
+
+
 #ifndef NO_MIGRATION
 bool q_migrate(struct q_conn * const c,
                const bool switch_ip,
@@ -1121,8 +1448,10 @@ bool q_migrate(struct q_conn * const c,
     }
 
     // close the current w_sock
+    socks_by_fd_del(c->sock);
     w_close(c->sock);
     c->sock = new_sock;
+    socks_by_fd_ins(c->sock);
 
     struct sockaddr_storage ss = {.ss_family = c->peer.addr.af};
     if (c->peer.addr.af == AF_INET) {
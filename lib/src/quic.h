@@ -52,16 +52,23 @@
 
 #include "cid.h"
 #include "frame.h"
+#include "kvec.h"
+#include "netem.h"
+#include "sign.h"
+#include "prof.h"
 #include "tree.h" // IWYU pragma: keep
 
 #ifndef NO_SERVER
-#include "kvec.h"
+#include "replay.h"
 #include "tls.h"
 #endif
 
 struct q_conn; // IWYU pragma: no_forward_declare q_conn
 
 
+KHASH_MAP_INIT_INT(socks_by_fd, struct w_sock *)
+
+
 // #define DEBUG_EXTRA ///< Set to log various extra details.
 // #define DEBUG_STREAMS ///< Set to log stream scheduling details.
 // #define DEBUG_TIMERS  ///< Set to log timer details.
@@ -181,6 +188,29 @@ struct per_engine_data {
     struct q_conf conf;
     struct timeout api_alarm;
 
+    q_event_cb event_cb;              ///< Callback for async API events.
+    void * event_arg;                 ///< Argument passed to the callback.
+    kvec_t(struct q_event) events;    ///< Events pending delivery.
+    khash_t(socks_by_fd) socks_by_fd; ///< All open warpcore sockets.
+    struct q_engine_stats stats;      ///< Engine-wide metrics.
+    uint64_t busy_t; ///< Busy time in the current loop iteration.
+#ifdef QUANT_PROFILE
+    struct q_hist prof[PROF_STAGES]; ///< Per-stage RX timing.
+#endif
+#ifdef HAVE_LIBURING
+    struct uring * uring; ///< io_uring state, if enabled in q_conf.
+#endif
+#ifdef QUANT_NETEM
+    struct netem * netem; ///< Network emulator, if attached.
+#endif
+    struct q_lb * lb; ///< QUIC-LB server CID encoding, if set in q_conf.
+#ifdef HAVE_ASYNC_SIGN
+    struct sign_pool * sign; ///< Off-loop TLS signing, if set in q_conf.
+#endif
+#ifndef NO_QLOG
+    struct qlog_ring * qlog; ///< Binary qlog ring, if enabled in q_conf.
+#endif
+
 #ifndef NO_TLS_LOG
     FILE * tls_log;
 #endif
@@ -194,13 +224,23 @@ struct per_engine_data {
 #endif
 
 #ifndef NO_SERVER
-    struct cipher_ctx dec_tckt;
-    struct cipher_ctx enc_tckt;
+    struct tckt_ring tckt;
+    struct replay_filter * replay; ///< 0-RTT anti-replay filter.
+#ifdef HAVE_CERT_CACHE
+    struct cert_cache cert_cache;
+#endif
     kvec_t(struct w_sock *) serv_socks;
+    uint64_t new_conns_t; ///< Start of the new-conn rate window.
+    uint32_t new_conns;   ///< Server conns created in the rate window.
+    uint32_t aq_len;      ///< Length of the accept queue.
+    uint32_t hshks;       ///< Server handshakes in progress.
+    uint8_t _unused3[4];
 #endif
 
 #ifdef NO_MIGRATION
     sl_head(conn_head, q_conn) conns;
+#else
+    struct q_conn * rx_hint; ///< Conn of the last valid RX'ed pkt.
 #endif
 
     uint8_t _unused2[4];
@@ -230,6 +270,10 @@ alloc_off(struct w_engine * const w,
 extern void __attribute__((nonnull))
 free_iov(struct w_iov * const v, struct pkt_meta * const m);
 
+extern void __attribute__((nonnull)) socks_by_fd_ins(struct w_sock * const ws);
+
+extern void __attribute__((nonnull)) socks_by_fd_del(struct w_sock * const ws);
+
 
 extern struct w_iov * __attribute__((nonnull))
 alloc_iov(struct w_engine * const w,
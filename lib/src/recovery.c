@@ -48,6 +48,7 @@
 #include "qlog.h"
 #include "quic.h"
 #include "recovery.h"
+#include "stats.h"
 #include "stream.h"
 #include "tls.h"
 
@@ -654,8 +655,10 @@ void on_ack_received_1(struct pkt_meta * const lg_ack, const uint_t ack_del)
                        : MAX(pn->lg_acked, lg_ack->hdr.nr);
 
     if (is_ack_eliciting(&pn->tx_frames)) {
-        c->rec.cur.latest_rtt = (uint_t)NS_TO_US(w_now() - lg_ack->t);
+        const uint64_t rtt = w_now() - lg_ack->t;
+        c->rec.cur.latest_rtt = (uint_t)NS_TO_US(rtt);
         update_rtt(c, likely(pn->type == pn_data) ? ack_del : 0);
+        hist_add(&ped(c->w)->stats.rtt, rtt);
     }
 
     // ProcessECN() is done in dec_ack_frame()
@@ -779,8 +782,8 @@ void on_pkt_acked(struct w_iov * const v, struct pkt_meta * m)
                 break;
             if (mou->is_fin)
                 fin_acked = true;
-            // if this ACKs a crypto packet, we can free it
-            if (unlikely(s->id < 0 && mou->lost == false)) {
+            // if this ACKs a crypto or lazily pulled packet, we can free it
+            if (unlikely((s->id < 0 || s->lazy_out) && mou->lost == false)) {
                 sq_remove(&s->out, s->out_una, w_iov, next);
                 sq_next(s->out_una, next) = 0;
                 free_iov(s->out_una, mou);
@@ -788,6 +791,7 @@ void on_pkt_acked(struct w_iov * const v, struct pkt_meta * m)
         }
 
         if (s->id >= 0 && out_fully_acked(s)) {
+            loop_event(c, s, q_ev_strm_writable);
             if (unlikely(fin_acked || c->did_0rtt)) {
                 // this ACKs a FIN
                 c->have_new_data = true;
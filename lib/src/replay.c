@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <quant/quant.h>
+
+#include "replay.h"
+
+
+#define REPLAY_BITS_LOG2 23 ///< Bits per Bloom filter, i.e., 1 MiB.
+#define REPLAY_HASHES 4     ///< Bits set per ID.
+#define REPLAY_FILTERS 3    ///< Current, previous and next (being cleared).
+#define REPLAY_WORDS ((1U << REPLAY_BITS_LOG2) / 64)
+
+
+// the layout of the shared mapping; all-zero is a valid, empty filter
+struct replay_map {
+    _Atomic uint64_t bucket; ///< Time bucket of the current filter.
+    _Atomic uint64_t bits[REPLAY_FILTERS][REPLAY_WORDS];
+};
+
+
+struct replay_filter {
+    struct replay_map * map;
+    uint32_t window; ///< Bucket length [s].
+    uint8_t _unused[4];
+};
+
+
+struct replay_filter * replay_new(const char * const file,
+                                  const uint32_t window)
+{
+    int fd = -1;
+    if (file) {
+        fd = open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        // growing the file zero-fills it; all processes agree on the size
+        if (fd == -1 || ftruncate(fd, sizeof(struct replay_map)) != 0) {
+            warn(ERR, "cannot share 0-RTT replay filter via %s: %s", file,
+                 strerror(errno));
+            if (fd != -1)
+                close(fd);
+            fd = -1;
+        }
+    }
+
+    struct replay_map * const map =
+        mmap(0, sizeof(*map), PROT_READ | PROT_WRITE,
+             MAP_SHARED | (fd == -1 ? MAP_ANONYMOUS : 0), fd, 0);
+    if (fd != -1)
+        close(fd);
+    ensure(map != MAP_FAILED, "mmap");
+
+    struct replay_filter * const rf = calloc(1, sizeof(*rf));
+    ensure(rf, "calloc");
+    rf->map = map;
+    rf->window = window;
+    warn(DBG, "0-RTT replay filter with %u-sec window%s%s", window,
+         fd != -1 ? " shared via " : "", fd != -1 ? file : "");
+    return rf;
+}
+
+
+void replay_free(struct replay_filter * const rf)
+{
+    if (rf == 0)
+        return;
+    munmap(rf->map, sizeof(*rf->map));
+    free(rf);
+}
+
+
+static void __attribute__((nonnull)) clear_bits(_Atomic uint64_t * const bits)
+{
+    for (uint32_t i = 0; i < REPLAY_WORDS; i++)
+        atomic_store_explicit(&bits[i], 0, memory_order_relaxed);
+}
+
+
+static void __attribute__((nonnull))
+rotate(struct replay_map * const m, const uint64_t bucket)
+{
+    uint64_t cur = atomic_load(&m->bucket);
+    while (cur < bucket) {
+        // whoever moves the bucket forward clears the expired filters
+        if (atomic_compare_exchange_weak(&m->bucket, &cur, bucket)) {
+            // nobody uses the filter after the new one until the next
+            // rotation, so it is empty long before it is published
+            clear_bits(m->bits[(bucket + 1) % REPLAY_FILTERS]);
+            if (bucket - cur > 1)
+                // after an idle window, the new filter may hold stale IDs;
+                // clearing it only now can drop an ID another process set
+                // in the meantime, which is a replay window we accept
+                clear_bits(m->bits[bucket % REPLAY_FILTERS]);
+            if (bucket - cur > 2)
+                clear_bits(m->bits[(bucket - 1) % REPLAY_FILTERS]);
+            break;
+        }
+    }
+}
+
+
+bool replay_seen(struct replay_filter * const rf,
+                 const uint64_t id,
+                 const time_t now)
+{
+    struct replay_map * const m = rf->map;
+    const uint64_t bucket = (uint64_t)now / rf->window;
+    rotate(m, bucket);
+
+    // IDs are random, so double hashing with their two halves suffices
+    const uint32_t h1 = (uint32_t)id;
+    const uint32_t h2 = (uint32_t)(id >> 32) | 1;
+    _Atomic uint64_t * const cur = m->bits[bucket % REPLAY_FILTERS];
+    _Atomic uint64_t * const prev = m->bits[(bucket - 1) % REPLAY_FILTERS];
+    bool in_cur = true;
+    bool in_prev = true;
+    for (uint32_t i = 0; i < REPLAY_HASHES; i++) {
+        const uint32_t bit = (h1 + i * h2) & ((1U << REPLAY_BITS_LOG2) - 1);
+        const uint64_t mask = UINT64_C(1) << (bit % 64);
+        in_cur &= (atomic_fetch_or_explicit(&cur[bit / 64], mask,
+                                            memory_order_relaxed) &
+                   mask) != 0;
+        in_prev &= (atomic_load_explicit(&prev[bit / 64],
+                                         memory_order_relaxed) &
+                    mask) != 0;
+    }
+    return in_cur || in_prev;
+}
@@ -0,0 +1,282 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <picotls.h>
+#include <quant/quant.h>
+
+#include "sign.h"
+
+#ifdef HAVE_ASYNC_SIGN
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <picotls/openssl.h>
+#include <timeout.h>
+
+#include "conn.h"
+#include "quic.h"
+#include "tls.h"
+
+
+#define SIGN_POLL_NS 100000 ///< How often to check for finished signatures.
+#define SIGN_ALGOS_MAX 16   ///< Signature algorithms offered by a client.
+
+
+/// A signature computed off the event loop. Picotls holds one reference
+/// (dropped via destroy_), the pool the other; both are only touched on the
+/// event loop, apart from the worker filling in the result.
+struct sign_job {
+    ptls_async_job_t super; ///< Must be first.
+    struct sign_job * next; ///< Next job in the work queue.
+    struct q_conn * c;      ///< Zero once picotls has let go of the job.
+    uint8_t * in;           ///< Copy of the data to sign.
+    size_t in_len;
+    ptls_buffer_t out; ///< Signature.
+    uint16_t algos[SIGN_ALGOS_MAX];
+    size_t algos_cnt;
+    uint16_t algo;     ///< Selected signature algorithm.
+    uint8_t refs;      ///< References held by picotls and the pool.
+    _Atomic bool done; ///< Set by the worker once the result is in.
+    int ret;
+};
+
+
+struct sign_pool {
+    ptls_sign_certificate_t super;     ///< Must be first.
+    ptls_sign_certificate_t * sign;    ///< The synchronous signer.
+    struct w_engine * w;               ///< Engine whose wheel polls for us.
+    kvec_t(struct sign_job *) pending; ///< Jobs waiting to be resumed.
+    struct timeout alarm;              ///< Polls the pending jobs.
+
+    pthread_mutex_t lock; ///< Protects the fields below.
+    pthread_cond_t cond;
+    struct sign_job * head; ///< Work queue.
+    struct sign_job * tail;
+    bool stop;
+
+    uint8_t _unused[6];
+    uint8_t thr_cnt;
+    pthread_t thr[];
+};
+
+
+static void __attribute__((nonnull)) unref_job(struct sign_job * const j)
+{
+    if (--j->refs)
+        return;
+    ptls_buffer_dispose(&j->out);
+    free(j->in);
+    free(j);
+}
+
+
+static void __attribute__((nonnull)) destroy_job(ptls_async_job_t * const aj)
+{
+    // picotls calls this once it is done with the job, or on ptls_free()
+    struct sign_job * const j = (struct sign_job *)aj;
+    j->c = 0;
+    unref_job(j);
+}
+
+
+static void * __attribute__((nonnull)) signer(void * const arg)
+{
+    struct sign_pool * const p = arg;
+    pthread_mutex_lock(&p->lock);
+    while (1) {
+        while (p->stop == false && p->head == 0)
+            pthread_cond_wait(&p->cond, &p->lock);
+        if (p->stop)
+            break;
+
+        struct sign_job * const j = p->head;
+        p->head = j->next;
+        if (p->head == 0)
+            p->tail = 0;
+        pthread_mutex_unlock(&p->lock);
+
+        // the picotls OpenSSL signer ignores the ptls_t and, when not set up
+        // for OpenSSL async, signs synchronously
+        ptls_async_job_t * no_job = 0;
+        j->ret = p->sign->cb(p->sign, 0, &no_job, &j->algo, &j->out,
+                             ptls_iovec_init(j->in, j->in_len), j->algos,
+                             j->algos_cnt);
+        atomic_store_explicit(&j->done, true, memory_order_release);
+
+        pthread_mutex_lock(&p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+
+static void __attribute__((nonnull)) poll_jobs(struct sign_pool * const p)
+{
+    for (size_t i = 0; i < kv_size(p->pending);) {
+        struct sign_job * const j = kv_A(p->pending, i);
+        if (atomic_load_explicit(&j->done, memory_order_acquire) == false) {
+            i++;
+            continue;
+        }
+
+        // order does not matter, so fill the hole with the last job
+        kv_A(p->pending, i) = kv_A(p->pending, kv_size(p->pending) - 1);
+        kv_size(p->pending)--;
+
+        struct q_conn * const c = j->c;
+        if (c && c->cstrms[ep_init] && c->state != conn_clsg &&
+            c->state != conn_drng) {
+            // let picotls pick up the signature and finish its flight
+            warn(DBG, "resuming hshk of %s conn %s after signing",
+                 conn_type(c), cid_str(c->scid));
+            if (tls_io(c->cstrms[ep_init], 0) == 0)
+                hshk_progress(c);
+            tx(c);
+        }
+        unref_job(j);
+    }
+
+    if (kv_size(p->pending))
+        timeouts_add(ped(p->w)->wheel, &p->alarm, SIGN_POLL_NS);
+}
+
+
+static int __attribute__((nonnull(1, 3, 4, 5)))
+sign_async(ptls_sign_certificate_t * const self,
+           ptls_t * const tls,
+           ptls_async_job_t ** const async,
+           uint16_t * const selected_algorithm,
+           ptls_buffer_t * const output,
+           const ptls_iovec_t input,
+           const uint16_t * const algorithms,
+           const size_t num_algorithms)
+{
+    struct sign_pool * const p = (struct sign_pool *)self;
+
+    if (*async) {
+        // we are being resumed, hand over the result
+        const struct sign_job * const j = (const struct sign_job *)*async;
+        if (j->ret)
+            return j->ret;
+        *selected_algorithm = j->algo;
+        return ptls_buffer__do_pushv(output, j->out.base, j->out.off);
+    }
+
+    struct sign_job * const j = calloc(1, sizeof(*j));
+    ensure(j, "could not calloc");
+    j->in = malloc(input.len);
+    ensure(j->in, "could not malloc");
+    memcpy(j->in, input.base, input.len);
+    j->in_len = input.len;
+    j->algos_cnt = MIN(num_algorithms, SIGN_ALGOS_MAX);
+    memcpy(j->algos, algorithms, j->algos_cnt * sizeof(*algorithms));
+    ptls_buffer_init(&j->out, "", 0);
+    j->super.destroy_ = destroy_job;
+    j->c = *ptls_get_data_ptr(tls);
+    j->refs = 2;
+
+    pthread_mutex_lock(&p->lock);
+    if (p->tail)
+        p->tail->next = j;
+    else
+        p->head = j;
+    p->tail = j;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+
+    if (kv_size(p->pending) == 0)
+        timeouts_add(ped(p->w)->wheel, &p->alarm, SIGN_POLL_NS);
+    kv_push(struct sign_job *, p->pending, j);
+
+    *async = &j->super;
+    return PTLS_ERROR_ASYNC_OPERATION;
+}
+
+
+void sign_pool_init(struct w_engine * const w, const uint8_t threads)
+{
+    if (ped(w)->tls_ctx.sign_certificate == 0) {
+        warn(WRN, "no TLS key, not starting signing threads");
+        return;
+    }
+
+    struct sign_pool * const p =
+        calloc(1, sizeof(*p) + threads * sizeof(p->thr[0]));
+    ensure(p, "could not calloc");
+    p->super.cb = sign_async;
+    p->sign = ped(w)->tls_ctx.sign_certificate;
+    p->w = w;
+    timeout_setcb(&p->alarm, poll_jobs, p);
+    pthread_mutex_init(&p->lock, 0);
+    pthread_cond_init(&p->cond, 0);
+
+    for (; p->thr_cnt < threads; p->thr_cnt++)
+        if (pthread_create(&p->thr[p->thr_cnt], 0, signer, p) != 0)
+            break;
+    if (unlikely(p->thr_cnt == 0)) {
+        warn(WRN, "could not start signing threads, signing inline");
+        free(p);
+        return;
+    }
+
+    ped(w)->tls_ctx.sign_certificate = &p->super;
+    ped(w)->sign = p;
+    warn(INF, "signing TLS handshakes on %u threads", p->thr_cnt);
+}
+
+
+void sign_pool_close(struct w_engine * const w)
+{
+    struct sign_pool * const p = ped(w)->sign;
+
+    pthread_mutex_lock(&p->lock);
+    p->stop = true;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    for (uint8_t i = 0; i < p->thr_cnt; i++)
+        pthread_join(p->thr[i], 0);
+
+    // conns are gone, so picotls has dropped its references
+    timeout_del(&p->alarm);
+    for (size_t i = 0; i < kv_size(p->pending); i++)
+        unref_job(kv_A(p->pending, i));
+    kv_destroy(p->pending);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+
+    ped(w)->tls_ctx.sign_certificate = p->sign;
+    free(p);
+    ped(w)->sign = 0;
+}
+
+#endif
@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include <quant/quant.h>
+
+#include "conn.h"
+#include "loop.h"
+#include "quic.h"
+
+
+void q_engine_stats(struct w_engine * const w, struct q_engine_stats * const st)
+{
+    memcpy(st, &ped(w)->stats, sizeof(*st));
+
+    // these are gauges, sample them now
+    st->bufs = (uint32_t)ped(w)->conf.num_bufs;
+    st->bufs_free = (uint32_t)w_iov_sq_cnt(&w->iov);
+    st->timers = loop_timer_cnt(w);
+#ifndef NO_SERVER
+    st->accept_queue = ped(w)->aq_len;
+    st->hshks = ped(w)->hshks;
+#else
+    st->accept_queue = 0;
+    st->hshks = 0;
+#endif
+}
+
+
+uint64_t q_hist_quantile(const struct q_hist * const h, const double q)
+{
+    if (h->cnt == 0)
+        return 0;
+
+    const uint64_t target = (uint64_t)ceil(q * (double)h->cnt);
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < Q_HIST_BKTS; i++) {
+        seen += h->bkt[i];
+        if (seen < target || h->bkt[i] == 0)
+            continue;
+        if (i < Q_HIST_SUB)
+            return i;
+
+        // report the highest value that falls into this bucket
+        const uint32_t e = i / Q_HIST_SUB + 1;
+        const uint64_t lo = (uint64_t)(Q_HIST_SUB + i % Q_HIST_SUB) << (e - 2);
+        const uint64_t hi = lo + (UINT64_C(1) << (e - 2)) - 1;
+        return hi < h->min ? h->min : hi > h->max ? h->max : hi;
+    }
+    return h->max;
+}
+
+
+struct prom_buf {
+    char * buf;
+    size_t len;
+    size_t pos;
+};
+
+
+static void __attribute__((nonnull, format(printf, 2, 3)))
+prom_printf(struct prom_buf * const b, const char * const fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    const int n = vsnprintf(b->buf + MIN(b->pos, b->len),
+                            b->len > b->pos ? b->len - b->pos : 0, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        b->pos += (size_t)n;
+}
+
+
+static void __attribute__((nonnull))
+prom_counter(struct prom_buf * const b,
+             const char * const name,
+             const char * const help,
+             const char * const type,
+             const uint64_t val)
+{
+    prom_printf(b, "# HELP quant_%s %s\n", name, help);
+    prom_printf(b, "# TYPE quant_%s %s\n", name, type);
+    prom_printf(b, "quant_%s %" PRIu64 "\n", name, val);
+}
+
+
+static void __attribute__((nonnull))
+prom_summary(struct prom_buf * const b,
+             const char * const name,
+             const char * const help,
+             const struct q_hist * const h)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+    prom_printf(b, "# HELP quant_%s_seconds %s\n", name, help);
+    prom_printf(b, "# TYPE quant_%s_seconds summary\n", name);
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+        prom_printf(b, "quant_%s_seconds{quantile=\"%g\"} %.9f\n", name,
+                    quantiles[i],
+                    (double)q_hist_quantile(h, quantiles[i]) / NS_PER_S);
+    prom_printf(b, "quant_%s_seconds_sum %.9f\n", name,
+                (double)h->sum / NS_PER_S);
+    prom_printf(b, "quant_%s_seconds_count %" PRIu64 "\n", name, h->cnt);
+}
+
+
+size_t q_stats_prometheus(const struct q_engine_stats * const st,
+                          char * const buf,
+                          const size_t len)
+{
+    struct prom_buf b = {.buf = buf, .len = len};
+
+    prom_counter(&b, "pkts_in_total", "UDP datagrams received.", "counter",
+                 st->pkts_in);
+    prom_counter(&b, "bytes_in_total", "UDP payload bytes received.",
+                 "counter", st->bytes_in);
+    prom_counter(&b, "pkts_in_decrypt_fail_total",
+                 "Packets that failed to decrypt.", "counter",
+                 st->pkts_in_dec_fail);
+    prom_counter(&b, "pkts_in_hint_total",
+                 "Packets matched to the connection of the previous one.",
+                 "counter", st->pkts_in_hint);
+    prom_counter(&b, "pkts_in_bad_token_total",
+                 "Initial packets with an invalid Retry token.", "counter",
+                 st->pkts_in_bad_tok);
+    prom_counter(&b, "pkts_out_total", "UDP datagrams sent.", "counter",
+                 st->pkts_out);
+    prom_counter(&b, "bytes_out_total", "UDP payload bytes sent.", "counter",
+                 st->bytes_out);
+    prom_counter(&b, "pkts_out_retry_total", "Retry packets sent.", "counter",
+                 st->pkts_out_rtry);
+    prom_counter(&b, "conns_refused_total",
+                 "Connections closed with SERVER_BUSY on arrival.", "counter",
+                 st->conns_refused);
+    prom_counter(&b, "tickets_reused_total",
+                 "Session tickets seen before, with any early data refused.",
+                 "counter", st->tckts_reused);
+
+    prom_counter(&b, "bufs", "Size of the buffer pool.", "gauge", st->bufs);
+    prom_counter(&b, "bufs_free", "Unallocated buffers.", "gauge",
+                 st->bufs_free);
+    prom_counter(&b, "accept_queue", "Connections waiting for q_accept().",
+                 "gauge", st->accept_queue);
+    prom_counter(&b, "hshks", "Server handshakes in progress.", "gauge",
+                 st->hshks);
+    prom_counter(&b, "timers", "Timers pending in the timer wheel.", "gauge",
+                 st->timers);
+
+    prom_summary(&b, "loop", "Busy time per event loop iteration.", &st->loop);
+    prom_summary(&b, "rtt", "RTT samples.", &st->rtt);
+    prom_summary(&b, "hshk", "Handshake duration.", &st->hshk);
+    prom_summary(&b, "rx", "Processing time per RX batch.", &st->rx);
+    prom_summary(&b, "tx", "Processing time per TX.", &st->tx);
+
+    // like snprintf(), return the length needed
+    return b.pos;
+}
+
+
+#ifdef QUANT_PROFILE
+void prof_dump(struct w_engine * const w)
+{
+    static const char * const stage_str[] = {[prof_hdr] = "hdr",
+                                             [prof_dec] = "decrypt",
+                                             [prof_frm] = "frames",
+                                             [prof_ack] = "ack",
+                                             [prof_strm] = "stream",
+                                             [prof_tls_io] = "tls_io",
+                                             [prof_init_tls] = "init_tls",
+                                             [prof_new_conn] = "new_conn",
+                                             [prof_free_conn] = "free_conn",
+                                             [prof_enc_pkt] = "enc_pkt",
+                                             [prof_enc] = "encrypt",
+                                             [prof_coalesce] = "coalesce",
+                                             [prof_w_tx] = "w_tx"};
+
+    warn(NTE, "stage profile (in " PROF_UNIT "):");
+    for (prof_stage_t s = prof_hdr; s < PROF_STAGES; s++) {
+        const struct q_hist * const h = &ped(w)->prof[s];
+        if (h->cnt == 0)
+            continue;
+        warn(NTE,
+             "%9s: n=%" PRIu64 " avg=%" PRIu64 " p50=%" PRIu64 " p90=%" PRIu64
+             " p99=%" PRIu64 " max=%" PRIu64,
+             stage_str[s], h->cnt, h->sum / h->cnt, q_hist_quantile(h, 0.5),
+             q_hist_quantile(h, 0.9), q_hist_quantile(h, 0.99), h->max);
+    }
+}
+#endif
@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include <stdint.h>
+
+#include <quant/quant.h>
+
+
+static inline uint32_t __attribute__((const)) hist_idx(const uint64_t v)
+{
+    if (v < Q_HIST_SUB)
+        return (uint32_t)v;
+
+    // two significant bits: the octave, plus the next two bits below the MSB
+    const uint32_t e = 63 - (uint32_t)__builtin_clzll(v);
+    const uint32_t idx =
+        (e - 1) * Q_HIST_SUB + (uint32_t)((v >> (e - 2)) & (Q_HIST_SUB - 1));
+    return idx < Q_HIST_BKTS ? idx : Q_HIST_BKTS - 1;
+}
+
+
+static inline void __attribute__((nonnull))
+hist_add(struct q_hist * const h, const uint64_t v)
+{
+    if (h->cnt == 0 || v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->cnt++;
+    h->sum += v;
+    h->bkt[hist_idx(v)]++;
+}
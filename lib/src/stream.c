@@ -25,16 +25,22 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/param.h>
+#include <unistd.h>
 
 #include <quant/quant.h>
 
 #include "cid.h"
 #include "conn.h"
 #include "diet.h"
+#include "loop.h"
 #include "quic.h"
 #include "recovery.h"
 #include "stream.h"
@@ -144,6 +150,7 @@ void free_stream(struct q_stream * const s)
             kh_get(strms_by_id, &c->strms_by_id, (khint64_t)s->id);
         ensure(k != kh_end(&c->strms_by_id), "found");
         kh_del(strms_by_id, &c->strms_by_id, k);
+        loop_event_purge(c, s);
     } else
         s->c->cstrms[strm_epoch(s)] = 0;
 
@@ -158,6 +165,8 @@ void free_stream(struct q_stream * const s)
     if (s->in_ctrl)
         sl_remove(&c->need_ctrl, s, q_stream, node_ctrl);
 
+    if (s->src)
+        free_src(s, true);
     q_free(&s->out);
     q_free(&s->in);
     free(s);
@@ -193,6 +202,8 @@ void reset_stream(struct q_stream * const s, const bool forget)
     s->lost_cnt = s->in_data_off = s->in_data = s->out_data = 0;
 
     if (forget) {
+        if (s->src)
+            free_src(s, true);
         s->out_una = 0;
         q_free(&s->out);
         q_free(&s->in);
@@ -284,6 +295,131 @@ void concat_out(struct q_stream * const s, struct w_iov_sq * const q)
 }
 
 
+void free_src(struct q_stream * const s, const bool abort)
+{
+    struct strm_src * const src = s->src;
+    if (src->fill) {
+        if (abort) {
+            // let the producer release its state
+            bool fin;
+            src->fill(s, 0, 0, &fin, src->fill_arg);
+        }
+    } else if (src->map)
+        munmap(src->map, src->map_len);
+    else
+        close(src->fd);
+    free(src);
+    s->src = 0;
+}
+
+
+static uint16_t __attribute__((nonnull))
+pull(struct q_stream * const s,
+     uint8_t * const buf,
+     const uint16_t max_len,
+     bool * const end)
+{
+    struct strm_src * const src = s->src;
+    if (src->fill) {
+        const uint32_t n = src->fill(s, buf, max_len, end, src->fill_arg);
+        ensure(n <= max_len, "producer returned %" PRIu32 " > %u", n, max_len);
+        return (uint16_t)n;
+    }
+
+    uint16_t n = (uint16_t)MIN(max_len, src->len - src->off);
+    if (likely(src->map))
+        memcpy(buf, src->data + src->off, n);
+    else {
+        // don't block the event loop on a pipe or socket that has no data yet
+        struct pollfd pfd = {.fd = src->fd, .events = POLLIN};
+        ssize_t ret = poll(&pfd, 1, 0);
+        if (ret == 1)
+            ret = read(src->fd, buf, n);
+        else if (ret == 0) {
+            errno = EAGAIN;
+            ret = -1;
+        }
+
+        if (unlikely(ret == -1)) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                // no data yet, the app calls q_resume_fill() once there is
+                *end = false;
+                return 0;
+            }
+            warn(ERR, "cannot read fd %d: %s", src->fd, strerror(errno));
+            ret = 0;
+        }
+
+        // a short read is fine, only EOF ends the stream early
+        if (unlikely(ret == 0))
+            src->len = src->off;
+        n = (uint16_t)ret;
+    }
+    src->off += n;
+    *end = src->off == src->len;
+    return n;
+}
+
+
+void strm_pull(struct q_stream * const s)
+{
+    // only pull more once everything we have has been TX'ed
+    // cppcheck-suppress nullPointer
+    struct w_iov * const last = sq_last(&s->out, w_iov, next);
+    if (last && meta(last).txed == false)
+        return;
+
+    // pull up to the open cwnd, plus one pkt so that tx_stream() notices when
+    // the window closes and we get called again once it reopens
+    struct q_conn * const c = s->c;
+    struct strm_src * const src = s->src;
+    const uint_t wnd = c->rec.cur.cwnd > c->rec.cur.in_flight
+                           ? c->rec.cur.cwnd - c->rec.cur.in_flight
+                           : 0;
+    size_t left = wnd + c->rec.max_ups;
+    if (src->fill == 0)
+        left = MIN(left, src->len - src->off);
+
+    struct w_iov_sq q = w_iov_sq_initializer(q);
+    bool end = false;
+    bool more = true;
+    while (more && left) {
+        // alloc about a pkt at a time, since a producer may run dry early
+        struct w_iov_sq o = w_iov_sq_initializer(o);
+        alloc_off(c->w, &o, c, q_conn_af(c),
+                  (uint32_t)MIN(left, c->rec.max_ups), DATA_OFFSET);
+        if (unlikely(sq_empty(&o))) {
+            warn(WRN, "could not alloc iov");
+            break;
+        }
+
+        while (!sq_empty(&o)) {
+            struct w_iov * const v = sq_first(&o);
+            sq_remove_head(&o, next);
+            sq_next(v, next) = 0;
+
+            const uint16_t max = v->len;
+            v->len = more ? pull(s, v->buf, max, &end) : 0;
+            left -= MIN(left, max);
+            more = end == false && v->len == max;
+
+            // keep an empty buf only if it needs to carry the FIN
+            if (v->len || (end && sq_empty(&q)))
+                sq_insert_tail(&q, v, next);
+            else
+                free_iov(v, &meta(v));
+        }
+    }
+
+    if (end) {
+        // cppcheck-suppress nullPointer
+        meta(sq_last(&q, w_iov, next)).is_fin = src->fill || src->fin;
+        free_src(s, false);
+    }
+    concat_out(s, &q);
+}
+
+
 bool q_is_uni_stream(const struct q_stream * const s)
 {
     return is_uni(s->id);
@@ -76,6 +76,21 @@ SPLAY_PROTOTYPE(ooo_by_off, pkt_meta, off_node, ooo_by_off_cmp)
 #endif
 
 
+/// Outbound data that is pulled into a stream only as the window opens.
+struct strm_src {
+    q_fill_cb fill;       ///< Application data producer, or zero for a file.
+    void * fill_arg;      ///< Argument passed to the producer.
+    uint8_t * map;        ///< Start of the mmap()'ed file, or zero.
+    const uint8_t * data; ///< First source byte inside the mapping.
+    size_t map_len;       ///< Length of the mapping.
+    size_t off;           ///< Offset of the next byte to pull.
+    size_t len;           ///< Total number of file bytes.
+    int fd;               ///< File to read() from, if it could not be mapped.
+    bool fin;             ///< Mark a FIN after the last byte?
+    uint8_t _unused[3];
+};
+
+
 struct q_stream {
     sl_entry(q_stream) node_ctrl;
 
@@ -83,6 +98,7 @@ struct q_stream {
 
     struct w_iov_sq out;    ///< Tail queue containing outbound data.
     struct w_iov * out_una; ///< Lowest un-ACK'ed data chunk.
+    struct strm_src * src;  ///< Lazy outbound data source, if any.
 
     struct w_iov_sq in; ///< Tail queue containing inbound data.
 #ifndef NO_OOO_DATA
@@ -104,7 +120,8 @@ struct q_stream {
     uint8_t in_ctrl : 1; ///< Stream is in connections "needs ctrl" list.
     uint8_t tx_max_strm_data : 1; ///< We need to open the receive window.
     uint8_t blocked : 1;          ///< We are receive-window-blocked.
-    uint8_t : 5;
+    uint8_t lazy_out : 1;         ///< Outbound data is pulled from src.
+    uint8_t : 4;
 
 #if HAVE_64BIT
     uint8_t _unused[3];
@@ -240,5 +257,10 @@ extern void __attribute__((nonnull)) do_stream_id_fc(struct q_conn * const c,
 extern void __attribute__((nonnull))
 concat_out(struct q_stream * const s, struct w_iov_sq * const q);
 
+extern void __attribute__((nonnull)) strm_pull(struct q_stream * const s);
+
+extern void __attribute__((nonnull))
+free_src(struct q_stream * const s, const bool abort);
+
 extern dint_t __attribute__((nonnull))
 max_sid(const dint_t sid, const struct q_conn * const c);
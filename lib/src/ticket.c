@@ -0,0 +1,506 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <quant/quant.h>
+
+#include "conn.h"
+#include "ticket.h"
+
+
+#define TICKETS_DEF 1024     ///< Default number of cached tickets.
+#define TICKET_MAX_LEN 8192  ///< Longest ticket we store.
+#define TICKETS_MIN_STALE 64 ///< Don't compact logs with fewer stale records.
+
+
+static inline khint_t __attribute__((nonnull, no_instrument_function))
+hash_ticket(const struct tls_ticket * const t)
+{
+    return fnv1a_32(t->sni, strlen(t->sni)) * 31 +
+           fnv1a_32(t->alpn, strlen(t->alpn));
+}
+
+
+static inline int __attribute__((nonnull, no_instrument_function))
+kh_ticket_cmp(const struct tls_ticket * const a,
+              const struct tls_ticket * const b)
+{
+    return strcmp(a->sni, b->sni) == 0 && strcmp(a->alpn, b->alpn) == 0;
+}
+
+
+KHASH_INIT(tickets_by_peer,
+           struct tls_ticket *,
+           char,
+           0,
+           hash_ticket,
+           kh_ticket_cmp)
+
+static khash_t(tickets_by_peer) tickets = {0};
+static struct tls_ticket * lru_old; ///< Next ticket to evict.
+static struct tls_ticket * lru_new; ///< Most recently used ticket.
+static uint32_t max_tickets;
+
+static char * log_path;
+static int log_fd = -1;   ///< Append-only ticket log, or -1.
+static uint32_t log_recs; ///< Records in the log, including stale ones.
+
+
+static void __attribute__((nonnull)) free_ticket(struct tls_ticket * const t)
+{
+    free(t->sni);
+    free(t->alpn);
+    free(t->ticket);
+    free(t);
+}
+
+
+static void __attribute__((nonnull)) lru_unlink(struct tls_ticket * const t)
+{
+    if (t->lru_prev)
+        t->lru_prev->lru_next = t->lru_next;
+    else
+        lru_old = t->lru_next;
+    if (t->lru_next)
+        t->lru_next->lru_prev = t->lru_prev;
+    else
+        lru_new = t->lru_prev;
+    t->lru_prev = t->lru_next = 0;
+}
+
+
+static void __attribute__((nonnull)) lru_append(struct tls_ticket * const t)
+{
+    t->lru_prev = lru_new;
+    t->lru_next = 0;
+    if (lru_new)
+        lru_new->lru_next = t;
+    else
+        lru_old = t;
+    lru_new = t;
+}
+
+
+// a log record is its length, followed by the SNI, ALPN, transport
+// parameters, version and ticket, all in host byte order
+static size_t __attribute__((nonnull))
+rec_len(const struct tls_ticket * const t)
+{
+    return sizeof(uint32_t) + 2 * sizeof(uint16_t) + strlen(t->sni) +
+           strlen(t->alpn) + sizeof(t->tp) + sizeof(t->vers) +
+           sizeof(uint32_t) + t->ticket_len;
+}
+
+
+static uint8_t * __attribute__((nonnull))
+put(uint8_t * const pos, const void * const src, const size_t len)
+{
+    memcpy(pos, src, len);
+    return pos + len;
+}
+
+
+static size_t __attribute__((nonnull))
+enc_rec(const struct tls_ticket * const t, uint8_t * const buf)
+{
+    const uint32_t len = (uint32_t)rec_len(t);
+    const uint16_t sni_len = (uint16_t)strlen(t->sni);
+    const uint16_t alpn_len = (uint16_t)strlen(t->alpn);
+    const uint32_t ticket_len = (uint32_t)t->ticket_len;
+
+    uint8_t * pos = put(buf, &len, sizeof(len));
+    pos = put(pos, &sni_len, sizeof(sni_len));
+    pos = put(pos, t->sni, sni_len);
+    pos = put(pos, &alpn_len, sizeof(alpn_len));
+    pos = put(pos, t->alpn, alpn_len);
+    pos = put(pos, &t->tp, sizeof(t->tp));
+    pos = put(pos, &t->vers, sizeof(t->vers));
+    pos = put(pos, &ticket_len, sizeof(ticket_len));
+    pos = put(pos, t->ticket, t->ticket_len);
+    return (size_t)(pos - buf);
+}
+
+
+static bool __attribute__((nonnull))
+get(const uint8_t ** const pos,
+    const uint8_t * const end,
+    void * const dst,
+    const size_t len)
+{
+    if (unlikely((size_t)(end - *pos) < len))
+        return false;
+    memcpy(dst, *pos, len);
+    *pos += len;
+    return true;
+}
+
+
+static char * __attribute__((nonnull))
+get_str(const uint8_t ** const pos, const uint8_t * const end)
+{
+    uint16_t len;
+    if (get(pos, end, &len, sizeof(len)) == false || len > UINT8_MAX)
+        return 0;
+    char * const str = calloc(1, len + 1);
+    ensure(str, "calloc");
+    if (get(pos, end, str, len) == false) {
+        free(str);
+        return 0;
+    }
+    return str;
+}
+
+
+static struct tls_ticket * __attribute__((nonnull))
+dec_rec(const uint8_t ** const pos, const uint8_t * const end)
+{
+    const uint8_t * const rec = *pos;
+    uint32_t len;
+    if (get(pos, end, &len, sizeof(len)) == false || len < sizeof(len) ||
+        (size_t)(end - rec) < len)
+        // truncated by a torn write
+        return 0;
+
+    const uint8_t * const rec_end = rec + len;
+    struct tls_ticket * const t = calloc(1, sizeof(*t));
+    ensure(t, "calloc");
+    uint32_t ticket_len;
+    if ((t->sni = get_str(pos, rec_end)) == 0 ||
+        (t->alpn = get_str(pos, rec_end)) == 0 ||
+        get(pos, rec_end, &t->tp, sizeof(t->tp)) == false ||
+        get(pos, rec_end, &t->vers, sizeof(t->vers)) == false ||
+        get(pos, rec_end, &ticket_len, sizeof(ticket_len)) == false ||
+        ticket_len > TICKET_MAX_LEN ||
+        (size_t)(rec_end - *pos) != ticket_len)
+        goto fail;
+
+    t->ticket_len = ticket_len;
+    t->ticket = calloc(1, ticket_len);
+    ensure(t->ticket, "calloc");
+    memcpy(t->ticket, *pos, ticket_len);
+    *pos = rec_end;
+    return t;
+
+fail:
+    free_ticket(t);
+    return 0;
+}
+
+
+static bool __attribute__((nonnull))
+write_rec(const int fd, const struct tls_ticket * const t)
+{
+    uint8_t * const buf = calloc(1, rec_len(t));
+    ensure(buf, "calloc");
+    const size_t len = enc_rec(t, buf);
+    // a single write, so concurrent appenders don't interleave records
+    const bool ok = write(fd, buf, len) == (ssize_t)len;
+    free(buf);
+    return ok;
+}
+
+
+static bool write_hdr(const int fd)
+{
+    return write(fd, &quant_commit_hash_len, sizeof(quant_commit_hash_len)) ==
+               (ssize_t)sizeof(quant_commit_hash_len) &&
+           write(fd, quant_commit_hash, quant_commit_hash_len) ==
+               (ssize_t)quant_commit_hash_len;
+}
+
+
+static void compact_log(void)
+{
+    char tmp[MAXPATHLEN];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", log_path);
+    const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (unlikely(fd == -1)) {
+        warn(ERR, "could not compact TLS tickets into %s: %s", tmp,
+             strerror(errno));
+        return;
+    }
+
+    // write oldest first, so replaying the log restores the LRU order
+    bool ok = write_hdr(fd);
+    for (const struct tls_ticket * t = lru_old; ok && t; t = t->lru_next)
+        ok = write_rec(fd, t);
+    close(fd);
+    if (unlikely(ok == false || rename(tmp, log_path) != 0)) {
+        warn(ERR, "could not compact TLS tickets into %s", log_path);
+        unlink(tmp);
+        return;
+    }
+
+    warn(INF, "compacted %u TLS ticket log records into %u", log_recs,
+         kh_size(&tickets));
+    if (log_fd != -1)
+        close(log_fd);
+    log_fd = open(log_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    log_recs = kh_size(&tickets);
+}
+
+
+static void __attribute__((nonnull)) add_ticket(struct tls_ticket * const t)
+{
+    int ret;
+    const khiter_t k = kh_put(tickets_by_peer, &tickets, t, &ret);
+    ensure(ret >= 0, "inserted");
+    if (ret == 0) {
+        // replace the previous ticket for this peer
+        struct tls_ticket * const old = kh_key(&tickets, k);
+        lru_unlink(old);
+        free_ticket(old);
+        kh_key(&tickets, k) = t;
+    }
+    lru_append(t);
+
+    while (kh_size(&tickets) > max_tickets) {
+        struct tls_ticket * const evict = lru_old;
+        warn(DBG, "evicting TLS ticket %s %s", evict->sni, evict->alpn);
+        lru_unlink(evict);
+        kh_del(tickets_by_peer, &tickets,
+               kh_get(tickets_by_peer, &tickets, evict));
+        free_ticket(evict);
+    }
+}
+
+
+static void __attribute__((nonnull))
+log_ticket(const struct tls_ticket * const t)
+{
+    if (log_fd == -1)
+        return;
+
+    if (unlikely(write_rec(log_fd, t) == false)) {
+        warn(ERR, "could not append TLS ticket to %s", log_path);
+        return;
+    }
+
+    if (++log_recs > 2 * kh_size(&tickets) + TICKETS_MIN_STALE)
+        compact_log();
+}
+
+
+static bool read_log(void)
+{
+    warn(INF, "reading TLS tickets from %s", log_path);
+    const int fd = open(log_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        warn(WRN, "could not read TLS tickets from %s: %s", log_path,
+             strerror(errno));
+        return true;
+    }
+
+    struct stat st;
+    ensure(fstat(fd, &st) == 0, "fstat");
+    const size_t len = (size_t)st.st_size;
+    if (len == 0) {
+        close(fd);
+        return true;
+    }
+    uint8_t * const buf = mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    ensure(buf != MAP_FAILED, "mmap");
+
+    // verify git hash
+    const uint8_t * pos = buf;
+    const uint8_t * const end = buf + len;
+    size_t hash_len;
+    bool clean = true;
+    if (get(&pos, end, &hash_len, sizeof(hash_len)) == false ||
+        hash_len != quant_commit_hash_len ||
+        (size_t)(end - pos) < hash_len ||
+        memcmp(pos, quant_commit_hash, hash_len) != 0) {
+        warn(WRN, "TLS tickets were stored by different %s version, removing",
+             quant_name);
+        ensure(unlink(log_path) == 0, "unlink");
+        goto done;
+    }
+    pos += hash_len;
+
+    while (pos < end) {
+        struct tls_ticket * const t = dec_rec(&pos, end);
+        if (t == 0) {
+            warn(WRN, "TLS ticket log %s is damaged, truncating", log_path);
+            clean = false;
+            break;
+        }
+        warn(DBG, "got TLS ticket %s %s", t->sni, t->alpn);
+        add_ticket(t);
+        log_recs++;
+    }
+    warn(INF, "got %u TLS tickets from %u log records", kh_size(&tickets),
+         log_recs);
+
+done:
+    munmap(buf, len);
+    return clean;
+}
+
+
+void tickets_init(const struct q_conf * const conf)
+{
+    max_tickets = conf->max_tickets ? conf->max_tickets : TICKETS_DEF;
+    if (conf->ticket_store == 0)
+        return;
+
+    log_path = strdup(conf->ticket_store);
+    ensure(log_path, "strdup");
+    const bool clean = read_log();
+
+    log_fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (unlikely(log_fd == -1)) {
+        warn(ERR, "could not open TLS ticket log %s: %s", log_path,
+             strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    ensure(fstat(log_fd, &st) == 0, "fstat");
+    if (st.st_size == 0)
+        ensure(write_hdr(log_fd), "write");
+    else if (clean == false ||
+             log_recs > 2 * kh_size(&tickets) + TICKETS_MIN_STALE)
+        compact_log();
+}
+
+
+void tickets_free(void)
+{
+    if (log_fd != -1) {
+        if (log_recs > kh_size(&tickets))
+            compact_log();
+        close(log_fd);
+        log_fd = -1;
+    }
+    free(log_path);
+    log_path = 0;
+
+    while (lru_old) {
+        struct tls_ticket * const t = lru_old;
+        lru_unlink(t);
+        free_ticket(t);
+    }
+    kh_release(tickets_by_peer, &tickets);
+    log_recs = 0;
+}
+
+
+const struct tls_ticket * tickets_find(char * const sni, char * const alpn)
+{
+    const struct tls_ticket which = {.sni = sni, .alpn = alpn};
+    const khiter_t k = kh_get(tickets_by_peer, &tickets, &which);
+    if (k == kh_end(&tickets))
+        return 0;
+
+    struct tls_ticket * const t = kh_key(&tickets, k);
+    lru_unlink(t);
+    lru_append(t);
+    return t;
+}
+
+
+void tickets_save(const char * const sni,
+                  const char * const alpn,
+                  const struct transport_params * const tp,
+                  const uint32_t vers,
+                  const uint8_t * const ticket,
+                  const size_t ticket_len)
+{
+    if (unlikely(strlen(sni) > UINT8_MAX || strlen(alpn) > UINT8_MAX ||
+                 ticket_len > TICKET_MAX_LEN)) {
+        warn(WRN, "not caching oversized TLS ticket for %s %s", sni, alpn);
+        return;
+    }
+
+    struct tls_ticket * const t = calloc(1, sizeof(*t));
+    ensure(t, "calloc");
+    t->sni = strdup(sni);
+    t->alpn = strdup(alpn);
+    t->ticket = calloc(1, ticket_len);
+    ensure(t->sni && t->alpn && t->ticket, "calloc");
+    memcpy(t->ticket, ticket, ticket_len);
+    t->ticket_len = ticket_len;
+    memcpy(&t->tp, tp, sizeof(t->tp));
+    t->vers = vers;
+
+    add_ticket(t);
+    log_ticket(t);
+}
+
+
+size_t q_ticket_export(const char * const sni,
+                       const char * const alpn,
+                       uint8_t * const buf,
+                       const size_t len)
+{
+    struct tls_ticket which = {.sni = strdup(sni), .alpn = strdup(alpn)};
+    ensure(which.sni && which.alpn, "strdup");
+    const khiter_t k = kh_get(tickets_by_peer, &tickets, &which);
+    free(which.sni);
+    free(which.alpn);
+    if (k == kh_end(&tickets))
+        return 0;
+
+    const struct tls_ticket * const t = kh_key(&tickets, k);
+    if (len < quant_commit_hash_len + rec_len(t))
+        return 0;
+
+    // prefix the record with the git hash, since it is only good for a
+    // peer running the same build
+    memcpy(buf, quant_commit_hash, quant_commit_hash_len);
+    return quant_commit_hash_len + enc_rec(t, buf + quant_commit_hash_len);
+}
+
+
+bool q_ticket_import(const uint8_t * const buf, const size_t len)
+{
+    if (len < quant_commit_hash_len ||
+        memcmp(buf, quant_commit_hash, quant_commit_hash_len) != 0)
+        return false;
+
+    const uint8_t * pos = buf + quant_commit_hash_len;
+    struct tls_ticket * const t = dec_rec(&pos, buf + len);
+    if (t == 0)
+        return false;
+
+    warn(INF, "imported TLS ticket %s %s", t->sni, t->alpn);
+    add_ticket(t);
+    log_ticket(t);
+    return true;
+}
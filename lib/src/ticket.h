@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+// Client-side cache of TLS session tickets, indexed by SNI and ALPN and
+// bounded by LRU eviction. With a ticket store configured, it is persisted
+// as an append-only log that is replayed at startup and compacted once it
+// holds too many stale records.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "conn.h"
+
+struct q_conf; // IWYU pragma: no_forward_declare q_conf
+
+
+struct tls_ticket {
+    struct tls_ticket * lru_prev; ///< Less recently used ticket.
+    struct tls_ticket * lru_next; ///< More recently used ticket.
+    char * sni;
+    char * alpn;
+    uint8_t * ticket;
+    size_t ticket_len;
+    struct transport_params tp;
+    uint32_t vers;
+    uint8_t _unused[12];
+};
+
+
+extern void __attribute__((nonnull))
+tickets_init(const struct q_conf * const conf);
+
+extern void tickets_free(void);
+
+extern const struct tls_ticket * __attribute__((nonnull))
+tickets_find(char * const sni, char * const alpn);
+
+extern void __attribute__((nonnull))
+tickets_save(const char * const sni,
+             const char * const alpn,
+             const struct transport_params * const tp,
+             const uint32_t vers,
+             const uint8_t * const ticket,
+             const size_t ticket_len);
@@ -40,6 +40,8 @@
 
 #ifndef NO_SERVER
 #include <sys/param.h>
+#include <sys/stat.h>
+#include <time.h>
 #endif
 
 #ifdef WITH_OPENSSL
@@ -108,51 +110,14 @@ static int uecc_rng(uint8_t * dest, unsigned size)
 #include "pkt.h"
 #include "pn.h"
 #include "quic.h"
+#include "replay.h"
 #include "stream.h"
+#include "ticket.h"
 #include "tls.h"
 
 
-struct tls_ticket {
-#if !defined(PARTICLE) && !defined(RIOT_VERSION)
-    splay_entry(tls_ticket) node;
-#endif
-    char * sni;
-    char * alpn;
-    uint8_t * ticket;
-    size_t ticket_len;
-    struct transport_params tp;
-    uint32_t vers;
-    uint8_t _unused[12];
-};
-
-
-struct tickets_by_peer {
-#if !defined(PARTICLE) && !defined(RIOT_VERSION)
-    splay_head(, tls_ticket);
-#else
-    struct tls_ticket last_ticket;
-#endif
-};
-
-static struct tickets_by_peer tickets;
-
-
-#if !defined(PARTICLE) && !defined(RIOT_VERSION)
-static int __attribute__((nonnull))
-tls_ticket_cmp(const struct tls_ticket * const a,
-               const struct tls_ticket * const b)
-{
-    int diff = strcmp(a->sni, b->sni);
-    if (diff)
-        return diff;
-
-    diff = strcmp(a->alpn, b->alpn);
-    return diff;
-}
-
-
-SPLAY_PROTOTYPE(tickets_by_peer, tls_ticket, node, tls_ticket_cmp)
-SPLAY_GENERATE(tickets_by_peer, tls_ticket, node, tls_ticket_cmp)
+#if defined(PARTICLE) || defined(RIOT_VERSION)
+static struct tls_ticket last_ticket;
 #endif
 
 
@@ -1059,17 +1024,122 @@ void init_tp(struct q_conn * const c)
 
 
 #ifndef NO_SERVER
-static void init_ticket_prot(struct per_engine_data * const ped)
+static void __attribute__((nonnull))
+read_tckt_secret(struct per_engine_data * const ped, const time_t now)
 {
+    // check the key file at most once a second, for a cheap reload
+    struct tckt_ring * const r = &ped->tckt;
+    if (r->checked == now)
+        return;
+    r->checked = now;
+
+    const char * const file = ped->conf.ticket_keys;
+    if (file == 0)
+        return;
+
+    struct stat st;
+    if (unlikely(stat(file, &st) != 0)) {
+        // a typo would otherwise silently break cross-process resumption
+        if (r->stat_failed == false)
+            warn(ERR, "cannot stat ticket key file %s: %s", file,
+                 strerror(errno));
+        r->stat_failed = true;
+        return;
+    }
+    r->stat_failed = false;
+    if (st.st_mtime == r->mtime)
+        return;
+
+    FILE * const fp = fopen(file, "rbe");
+    if (unlikely(fp == 0)) {
+        warn(ERR, "could not open ticket key file %s", file);
+        return;
+    }
+    uint8_t buf[4096];
+    const size_t len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    if (unlikely(len < 16)) {
+        warn(ERR, "ticket key file %s too short, need 16+ bytes", file);
+        return;
+    }
+
+    // any format will do, the secret is the hash of the file
     const ptls_cipher_suite_t * const cs = &aes128gcmsha256;
-    uint8_t output[PTLS_MAX_SECRET_SIZE] = {0};
-    memcpy(output, quant_commit_hash,
-           MIN(quant_commit_hash_len, sizeof(output)));
-    setup_cipher(&ped->dec_tckt.header_protection, &ped->dec_tckt.aead,
-                 cs->aead, cs->hash, 0, output);
-    setup_cipher(&ped->enc_tckt.header_protection, &ped->enc_tckt.aead,
-                 cs->aead, cs->hash, 1, output);
-    ptls_clear_memory(output, sizeof(output));
+    ptls_calc_hash(cs->hash, r->secret, buf, len);
+    ptls_clear_memory(buf, sizeof(buf));
+    r->mtime = st.st_mtime;
+
+    // force all keys to be derived again
+    for (size_t i = 0; i < TCKT_KEYS; i++)
+        r->key[i].epoch = UINT64_MAX;
+    warn(NTE, "read ticket key secret from %s", file);
+}
+
+
+static void __attribute__((nonnull))
+rotate_tckt_keys(struct per_engine_data * const ped)
+{
+    struct tckt_ring * const r = &ped->tckt;
+    const time_t now = time(0);
+    read_tckt_secret(ped, now);
+
+    // the keys for the adjacent periods are kept around for clock skew
+    // between processes and for tickets issued before the last rotation
+    const uint64_t epoch = (uint64_t)now / r->period;
+    const ptls_cipher_suite_t * const cs = &aes128gcmsha256;
+    for (uint64_t e = epoch - 1; e <= epoch + 1; e++) {
+        struct tckt_key * const k = &r->key[e % TCKT_KEYS];
+        if (k->epoch == e)
+            continue;
+
+        dispose_cipher(&k->enc);
+        dispose_cipher(&k->dec);
+        uint8_t key[PTLS_MAX_DIGEST_SIZE];
+        const uint64_t e_be = bswap64(e);
+        ptls_hkdf_expand_label(cs->hash, key, cs->hash->digest_size,
+                               ptls_iovec_init(r->secret,
+                                               cs->hash->digest_size),
+                               "quant tckt",
+                               ptls_iovec_init(&e_be, sizeof(e_be)), 0);
+        setup_cipher(0, &k->enc.aead, cs->aead, cs->hash, 1, key);
+        setup_cipher(0, &k->dec.aead, cs->aead, cs->hash, 0, key);
+        ptls_clear_memory(key, sizeof(key));
+        k->epoch = e;
+    }
+
+    if (r->epoch != epoch) {
+        warn(INF, "ticket key rotation period now %" PRIu64, epoch);
+        r->epoch = epoch;
+    }
+}
+
+
+static void init_ticket_prot(struct per_engine_data * const ped)
+{
+    // without a key file, tickets are only good for this build
+    struct tckt_ring * const r = &ped->tckt;
+    memcpy(r->secret, quant_commit_hash,
+           MIN(quant_commit_hash_len, sizeof(r->secret)));
+    r->period = ped->conf.ticket_key_period ? ped->conf.ticket_key_period
+                                            : TCKT_PERIOD;
+    r->checked = -1;
+    for (size_t i = 0; i < TCKT_KEYS; i++)
+        r->key[i].epoch = UINT64_MAX;
+    rotate_tckt_keys(ped);
+
+    // remember ticket IDs for at least the ticket lifetime
+    ped->replay = replay_new(ped->conf.replay_file, TCKT_LIFETIME);
+}
+
+
+static void free_ticket_prot(struct per_engine_data * const ped)
+{
+    for (size_t i = 0; i < TCKT_KEYS; i++) {
+        dispose_cipher(&ped->tckt.key[i].enc);
+        dispose_cipher(&ped->tckt.key[i].dec);
+    }
+    ptls_clear_memory(ped->tckt.secret, sizeof(ped->tckt.secret));
+    replay_free(ped->replay);
 }
 
 
@@ -1081,9 +1151,14 @@ static int encrypt_ticket_cb(ptls_encrypt_ticket_t * self
                              ptls_iovec_t src)
 {
     struct q_conn * const c = *ptls_get_data_ptr(tls);
+    struct tckt_ring * const r = &ped(c->w)->tckt;
+    rotate_tckt_keys(ped(c->w));
+
+    uint64_t epoch;
     uint64_t tid;
-    if (ptls_buffer_reserve(dst, src.len + quant_commit_hash_len + sizeof(tid) +
-                                     ped(c->w)->enc_tckt.aead->algo->tag_size))
+    const size_t tag_len = r->key[0].enc.aead->algo->tag_size;
+    if (ptls_buffer_reserve(dst, src.len + quant_commit_hash_len +
+                                     sizeof(epoch) + sizeof(tid) + tag_len))
         return -1;
 
     if (is_encrypt) {
@@ -1095,20 +1170,28 @@ static int encrypt_ticket_cb(ptls_encrypt_ticket_t * self
         memcpy(dst->base + dst->off, quant_commit_hash, quant_commit_hash_len);
         dst->off += quant_commit_hash_len;
 
+        // append key period
+        epoch = bswap64(r->epoch);
+        memcpy(dst->base + dst->off, &epoch, sizeof(epoch));
+        dst->off += sizeof(epoch);
+
         // append ticket id
         rand_bytes(&tid, sizeof(tid));
         memcpy(dst->base + dst->off, &tid, sizeof(tid));
         dst->off += sizeof(tid);
 
         // now encrypt ticket
-        dst->off +=
-            ptls_aead_encrypt(ped(c->w)->enc_tckt.aead, dst->base + dst->off,
-                              src.base, src.len, tid, 0, 0);
+        dst->off += ptls_aead_encrypt(r->key[r->epoch % TCKT_KEYS].enc.aead,
+                                      dst->base + dst->off, src.base, src.len,
+                                      tid, 0, 0);
 
     } else {
-        if (src.len < quant_commit_hash_len + sizeof(tid) +
-                          ped(c->w)->dec_tckt.aead->algo->tag_size ||
-            memcmp(src.base, quant_commit_hash, quant_commit_hash_len) != 0) {
+        // with a shared key file, tickets outlive a build (rolling upgrades)
+        if (src.len < quant_commit_hash_len + sizeof(epoch) + sizeof(tid) +
+                          tag_len ||
+            (ped(c->w)->conf.ticket_keys == 0 &&
+             memcmp(src.base, quant_commit_hash, quant_commit_hash_len) !=
+                 0)) {
             warn(WRN,
                  "could not verify 0-RTT session ticket for %s conn %s (%s "
                  "%s)",
@@ -1120,13 +1203,21 @@ static int encrypt_ticket_cb(ptls_encrypt_ticket_t * self
         uint8_t * src_base = src.base + quant_commit_hash_len;
         size_t src_len = src.len - quant_commit_hash_len;
 
+        memcpy(&epoch, src_base, sizeof(epoch));
+        epoch = bswap64(epoch);
+        src_base += sizeof(epoch);
+        src_len -= sizeof(epoch);
+
         memcpy(&tid, src_base, sizeof(tid));
         src_base += sizeof(tid);
         src_len -= sizeof(tid);
 
+        const struct tckt_key * const k = &r->key[epoch % TCKT_KEYS];
         const size_t n =
-            ptls_aead_decrypt(ped(c->w)->dec_tckt.aead, dst->base + dst->off,
-                              src_base, src_len, tid, 0, 0);
+            k->epoch == epoch
+                ? ptls_aead_decrypt(k->dec.aead, dst->base + dst->off,
+                                    src_base, src_len, tid, 0, 0)
+                : SIZE_MAX;
 
         if (n > src_len) {
             warn(WRN,
@@ -1139,6 +1230,25 @@ static int encrypt_ticket_cb(ptls_encrypt_ticket_t * self
         }
         dst->off += n;
 
+        // the ticket is fine for resumption, but only once for 0-RTT; we
+        // can't tell here whether the ClientHello offers early data, so a
+        // reuse is not necessarily a replay
+        if (replay_seen(ped(c->w)->replay, tid, time(0))) {
+            warn(INF,
+                 "session ticket reused for %s conn %s (%s %s), refusing "
+                 "early data",
+                 conn_type(c), cid_str(c->scid), ptls_get_server_name(tls),
+                 ptls_get_negotiated_protocol(tls));
+            ped(c->w)->stats.tckts_reused++;
+            c->did_0rtt = false;
+#ifdef PTLS_ERROR_REJECT_EARLY_DATA
+            return PTLS_ERROR_REJECT_EARLY_DATA;
+#else
+            // older picotls cannot reject just the early data
+            return -1;
+#endif
+        }
+
         warn(INF, "verified 0-RTT session ticket for %s conn %s (%s %s)",
              conn_type(c), cid_str(c->scid), ptls_get_server_name(tls),
              ptls_get_negotiated_protocol(tls));
@@ -1155,51 +1265,21 @@ static int save_ticket_cb(ptls_save_ticket_t * self __attribute__((unused)),
                           ptls_iovec_t src)
 {
     struct q_conn * const c = *ptls_get_data_ptr(tls);
+    const char * const s = ptls_get_server_name(tls);
+    const char * const a = ptls_get_negotiated_protocol(tls);
+    warn(INF, "caching TLS ticket for %s conn %s (%s %s)", conn_type(c),
+         cid_str(c->scid), s ? s : "", a ? a : "");
 
 #if !defined(PARTICLE) && !defined(RIOT_VERSION)
-    const char * const ticket_store = ped(c->w)->conf.ticket_store;
-    warn(NTE, "saving TLS tickets to %s", ticket_store);
-    FILE * const fp = fopen(ticket_store, "wbe");
-    ensure(fp, "could not open ticket file %s", ticket_store);
-
-    // write git hash
-    ensure(fwrite(&quant_commit_hash_len, sizeof(quant_commit_hash_len), 1, fp),
-           "fwrite");
-    ensure(fwrite(quant_commit_hash, quant_commit_hash_len, 1, fp), "fwrite");
-#endif
-
-    char * s = 0;
-    if (ptls_get_server_name(tls))
-        s = strdup(ptls_get_server_name(tls));
-    else
-        s = calloc(1, sizeof(char));
-    char * a = 0;
-    if (ptls_get_negotiated_protocol(tls))
-        a = strdup(ptls_get_negotiated_protocol(tls));
-    else
-        a = calloc(1, sizeof(char));
-#if !defined(PARTICLE) && !defined(RIOT_VERSION)
-    const struct tls_ticket which = {.sni = s, .alpn = a};
-    struct tls_ticket * t = splay_find(tickets_by_peer, &tickets, &which);
-    if (t == 0) {
-        // create new ticket
-        t = calloc(1, sizeof(*t));
-        ensure(t, "calloc");
-        t->sni = s;
-        t->alpn = a;
-        ensure(splay_insert(tickets_by_peer, &tickets, t) == 0, "inserted");
-    } else {
-        // update current ticket
-        free(t->ticket);
-        free(s);
-        free(a);
-    }
+    tickets_save(s ? s : "", a ? a : "", &c->tp_peer, c->vers, src.base,
+                 src.len);
 #else
-    struct tls_ticket * const t = &tickets.last_ticket;
-    t->sni = s;
-    t->alpn = a;
-#endif
-
+    struct tls_ticket * const t = &last_ticket;
+    free(t->sni);
+    free(t->alpn);
+    free(t->ticket);
+    t->sni = strdup(s ? s : "");
+    t->alpn = strdup(a ? a : "");
     memcpy(&t->tp, &c->tp_peer, sizeof(t->tp));
     t->vers = c->vers;
 
@@ -1207,33 +1287,6 @@ static int save_ticket_cb(ptls_save_ticket_t * self __attribute__((unused)),
     t->ticket = calloc(1, t->ticket_len);
     ensure(t->ticket, "calloc");
     memcpy(t->ticket, src.base, src.len);
-
-    // write all tickets
-    // FIXME this currently dumps the entire cache to file on each connection!
-#if !defined(PARTICLE) && !defined(RIOT_VERSION)
-    splay_foreach (t, tickets_by_peer, &tickets) {
-#endif
-        warn(INF, "writing TLS ticket for %s conn %s (%s %s)", conn_type(c),
-             cid_str(c->scid), t->sni, t->alpn);
-
-#if !defined(PARTICLE) && !defined(RIOT_VERSION)
-        size_t len = strlen(t->sni) + 1;
-        ensure(fwrite(&len, sizeof(len), 1, fp), "fwrite");
-        ensure(fwrite(t->sni, sizeof(*t->sni), len, fp), "fwrite");
-
-        len = strlen(t->alpn) + 1;
-        ensure(fwrite(&len, sizeof(len), 1, fp), "fwrite");
-        ensure(fwrite(t->alpn, sizeof(*t->alpn), len, fp), "fwrite");
-
-        ensure(fwrite(&t->tp, sizeof(t->tp), 1, fp), "fwrite");
-        ensure(fwrite(&t->vers, sizeof(t->vers), 1, fp), "fwrite");
-
-        ensure(fwrite(&t->ticket_len, sizeof(t->ticket_len), 1, fp), "fwrite");
-        ensure(fwrite(t->ticket, sizeof(*t->ticket), t->ticket_len, fp),
-               "fwrite");
-    }
-
-    fclose(fp);
 #endif
 
     return 0;
@@ -1252,6 +1305,7 @@ void init_tls(struct q_conn * const c,
               const char * const serv_name,
               const char * const clnt_alpn)
 {
+    prof_start(t_init);
     char * const sni =
         is_clnt(c)
             ? strdup(c->tls.t ? ptls_get_server_name(c->tls.t) : serv_name)
@@ -1297,17 +1351,13 @@ void init_tls(struct q_conn * const c,
 
         // try to find an existing session ticket
 #if !defined(PARTICLE) && !defined(RIOT_VERSION)
-        struct tls_ticket which = {// this works, because of strdup() allocation
-                                   .sni = sni,
-                                   .alpn = (char *)c->tls.alpn.base};
-        struct tls_ticket * t = splay_find(tickets_by_peer, &tickets, &which);
-        if (t == 0) {
+        const struct tls_ticket * t =
+            tickets_find(sni, (char *)c->tls.alpn.base);
+        if (t == 0)
             // if we couldn't find a ticket, try without an alpn
-            which.alpn = "";
-            t = splay_find(tickets_by_peer, &tickets, &which);
-        }
+            t = tickets_find(sni, "");
 #else
-        struct tls_ticket * const t = &tickets.last_ticket;
+        const struct tls_ticket * const t = &last_ticket;
 #endif
         if (t && t->vers != 0) {
             hshk_prop->client.session_ticket =
@@ -1322,6 +1372,7 @@ void init_tls(struct q_conn * const c,
         free(sni);
 
     init_prot(c);
+    prof_stop(c->w, prof_init_tls, t_init);
 }
 
 
@@ -1372,6 +1423,7 @@ int tls_io(struct q_stream * const s, struct w_iov * const iv)
     const epoch_t ep_in = strm_epoch(s);
     size_t epoch_off[5] = {0};
     ptls_buffer_t tls_io;
+    prof_start(t_io);
 
     unpoison_scratch(ped(c->w)->scratch, ped(c->w)->scratch_len);
     ptls_buffer_init(&tls_io, ped(c->w)->scratch, ped(c->w)->scratch_len);
@@ -1418,6 +1470,10 @@ int tls_io(struct q_stream * const s, struct w_iov * const iv)
         }
 
     } else if (ret != PTLS_ERROR_IN_PROGRESS &&
+#ifdef HAVE_ASYNC_SIGN
+               // sign_async() resumes the handshake once it has a signature
+               ret != PTLS_ERROR_ASYNC_OPERATION &&
+#endif
                ret != PTLS_ERROR_STATELESS_RETRY) {
         err_close(c, ERR_TLS(PTLS_ERROR_TO_ALERT(ret)), FRM_CRY, "TLS error %u",
                   ret);
@@ -1452,106 +1508,11 @@ int tls_io(struct q_stream * const s, struct w_iov * const iv)
 done:
     ptls_buffer_dispose(&tls_io);
     poison_scratch(ped(c->w)->scratch, ped(c->w)->scratch_len);
+    prof_stop(c->w, prof_tls_io, t_io);
     return ret;
 }
 
 
-#if !defined(PARTICLE) && !defined(RIOT_VERSION)
-static void __attribute__((nonnull)) free_ticket(struct tls_ticket * const t)
-{
-    if (t->sni)
-        free(t->sni);
-    if (t->alpn)
-        free(t->alpn);
-    if (t->ticket)
-        free(t->ticket);
-    free(t);
-}
-#endif
-
-
-static void read_tickets(const struct q_conf * const conf)
-{
-    warn(INF, "reading TLS tickets from %s", conf->ticket_store);
-
-#if !defined(PARTICLE) && !defined(RIOT_VERSION)
-    FILE * const fp = fopen(conf->ticket_store, "rbe");
-    if (fp == 0) {
-        warn(WRN, "could not read TLS tickets from %s: %s", conf->ticket_store,
-             strerror(errno));
-        return;
-    }
-
-    // read and verify git hash
-    size_t hash_len;
-    if (fread(&hash_len, sizeof(quant_commit_hash_len), 1, fp) != 1)
-        goto done;
-    if (hash_len != quant_commit_hash_len)
-        goto remove;
-    uint8_t buf[8192];
-    if (fread(buf, sizeof(uint8_t), hash_len, fp) != hash_len)
-        goto remove;
-    if (memcmp(buf, quant_commit_hash, hash_len) != 0) {
-    remove:
-        warn(WRN, "TLS tickets were stored by different %s version, removing",
-             quant_name);
-        ensure(unlink(conf->ticket_store) == 0, "unlink");
-        goto done;
-    }
-
-    for (;;) {
-        // try and read the SNI len
-        size_t len;
-        if (fread(&len, sizeof(len), 1, fp) != 1)
-            // we read all the tickets
-            break;
-        ensure(len <= 256, "SNI len %lu too long", len);
-
-        struct tls_ticket * const t = calloc(1, sizeof(*t));
-        ensure(t, "calloc");
-        t->sni = calloc(1, len);
-        ensure(t->sni, "calloc");
-        if (fread(t->sni, sizeof(*t->sni), len, fp) != len)
-            goto abort;
-        t->sni[len - 1] = 0;
-
-        if (fread(&len, sizeof(len), 1, fp) != 1)
-            goto abort;
-        ensure(len <= 256, "ALPN len %lu too long", len);
-        t->alpn = calloc(1, len);
-        ensure(t->alpn, "calloc");
-        if (fread(t->alpn, sizeof(*t->alpn), len, fp) != len)
-            goto abort;
-        t->alpn[len - 1] = 0;
-
-        if (fread(&t->tp, sizeof(t->tp), 1, fp) != 1)
-            goto abort;
-        if (fread(&t->vers, sizeof(t->vers), 1, fp) != 1)
-            goto abort;
-
-        if (fread(&len, sizeof(len), 1, fp) != 1)
-            goto abort;
-        ensure(len <= 8192, "ticket_len %lu too long", len);
-        t->ticket_len = len;
-        t->ticket = calloc(len, sizeof(*t->ticket));
-        ensure(t->ticket, "calloc");
-        if (fread(t->ticket, sizeof(*t->ticket), len, fp) != len)
-            goto abort;
-
-        ensure(splay_insert(tickets_by_peer, &tickets, t) == 0, "inserted");
-        warn(INF, "got TLS ticket %s %s", t->sni, t->alpn);
-        continue;
-    abort:
-        free_ticket(t);
-        break;
-    }
-
-done:
-    fclose(fp);
-#endif
-}
-
-
 #ifndef NO_TLS_LOG
 static void __attribute__((format(printf, 4, 5)))
 log_event_cb(ptls_log_event_t * const self __attribute__((unused)),
@@ -1642,6 +1603,101 @@ static uint64_t get_time(ptls_get_time_t * self __attribute__((unused)))
 }
 
 
+#ifdef HAVE_CERT_CACHE
+static int emit_cert_cb(ptls_emit_certificate_t * const self,
+                        ptls_t * const tls __attribute__((unused)),
+                        ptls_message_emitter_t * const emitter,
+                        ptls_key_schedule_t * const key_sched,
+                        const ptls_iovec_t context,
+                        const int push_status_request,
+                        const uint16_t * const compress_algos
+                        __attribute__((unused)),
+                        const size_t num_compress_algos
+                        __attribute__((unused)))
+{
+    struct cert_cache * const cc = (struct cert_cache *)(void *)self;
+    if (context.len)
+        // not a server certificate, let picotls handle it
+        return PTLS_ERROR_DELEGATE;
+
+#ifdef HAVE_CERT_COMPRESSION
+    for (size_t i = 0; i < num_compress_algos; i++)
+        if (compress_algos[i] == PTLS_CERTIFICATE_COMPRESSION_ALGORITHM_BROTLI)
+            return cc->ccert.super.cb(&cc->ccert.super, tls, emitter,
+                                      key_sched, context, push_status_request,
+                                      compress_algos, num_compress_algos);
+#endif
+
+    const ptls_iovec_t * const msg =
+        &cc->msg[push_status_request && cc->msg[1].len ? 1 : 0];
+    int ret;
+    ptls_push_message(emitter, key_sched, PTLS_HANDSHAKE_TYPE_CERTIFICATE, {
+        ptls_buffer_pushv(emitter->buf, msg->base, msg->len);
+    });
+Exit:
+    return ret;
+}
+
+
+static void __attribute__((nonnull(1)))
+init_cert_cache(struct per_engine_data * const ped, const char * const ocsp)
+{
+    ptls_context_t * const tls_ctx = &ped->tls_ctx;
+    struct cert_cache * const cc = &ped->cert_cache;
+
+    ptls_iovec_t status = {0};
+    if (ocsp) {
+        FILE * const fp = fopen(ocsp, "rbe");
+        ensure(fp, "could not open OCSP response %s", ocsp);
+        status.base = calloc(1, UINT16_MAX);
+        ensure(status.base, "calloc");
+        status.len = fread(status.base, 1, UINT16_MAX, fp);
+        fclose(fp);
+        ensure(status.len, "could not read OCSP response %s", ocsp);
+    }
+
+    // build the Certificate messages once, rather than for each handshake
+    for (size_t i = 0; i < (status.len ? 2 : 1); i++) {
+        ptls_buffer_t buf;
+        ptls_buffer_init(&buf, "", 0);
+        ensure(ptls_build_certificate_message(
+                   &buf, ptls_iovec_init(0, 0), tls_ctx->certificates.list,
+                   tls_ctx->certificates.count,
+                   i ? status : ptls_iovec_init(0, 0)) == 0,
+               "ptls_build_certificate_message");
+        cc->msg[i] = ptls_iovec_init(buf.base, buf.off);
+    }
+
+#ifdef HAVE_CERT_COMPRESSION
+    ensure(ptls_init_compressed_certificate(
+               &cc->ccert, tls_ctx->certificates.list,
+               tls_ctx->certificates.count, status) == 0,
+           "ptls_init_compressed_certificate");
+#endif
+
+    warn(DBG, "cached %zu-byte TLS certificate msg%s", cc->msg[0].len,
+         status.len ? " with OCSP response" : "");
+    free(status.base);
+    cc->super.cb = emit_cert_cb;
+    tls_ctx->emit_certificate = &cc->super;
+}
+
+
+static void __attribute__((nonnull))
+free_cert_cache(struct per_engine_data * const ped)
+{
+    struct cert_cache * const cc = &ped->cert_cache;
+    if (cc->super.cb == 0)
+        return;
+    free(cc->msg[0].base);
+    free(cc->msg[1].base);
+#ifdef HAVE_CERT_COMPRESSION
+    ptls_dispose_compressed_certificate(&cc->ccert);
+#endif
+}
+#endif
+
+
 void init_tls_ctx(const struct q_conf * const conf,
                   struct per_engine_data * const ped)
 {
@@ -1678,18 +1734,20 @@ void init_tls_ctx(const struct q_conf * const conf,
     if (conf && conf->tls_cert) {
         const int ret = ptls_load_certificates(tls_ctx, conf->tls_cert);
         ensure(ret == 0, "ptls_load_certificates");
+#ifdef HAVE_CERT_CACHE
+        init_cert_cache(ped, conf->tls_ocsp);
+#endif
     }
-    splay_init(&tickets);
+    if (conf)
+        tickets_init(conf);
 #endif
 
-    if (conf && conf->ticket_store) {
+    if (conf && (conf->ticket_store || conf->max_tickets))
         tls_ctx->save_ticket = &save_ticket;
-        read_tickets(conf);
-    }
 #ifndef NO_SERVER
     tls_ctx->encrypt_ticket = &encrypt_ticket;
     tls_ctx->max_early_data_size = UINT32_MAX;
-    tls_ctx->ticket_lifetime = 60 * 60 * 24;
+    tls_ctx->ticket_lifetime = TCKT_LIFETIME;
     tls_ctx->require_dhe_on_psk = 0;
 #endif
 
@@ -1743,6 +1801,10 @@ void init_tls_ctx(const struct q_conf * const conf,
     tls_ctx->on_client_hello = &on_client_hello;
     tls_ctx->update_traffic_key = &update_traffic_key;
     tls_ctx->random_bytes = rand_bytes;
+#ifdef HAVE_CERT_COMPRESSION
+    // have servers send us compressed certificates
+    tls_ctx->decompress_certificate = &ptls_decompress_certificate;
+#endif
 #ifdef WITH_OPENSSL
     tls_ctx->sign_certificate = &ped->sign_cert.super;
     if (conf && conf->enable_tls_cert_verify)
@@ -1768,20 +1830,15 @@ void init_tls_ctx(const struct q_conf * const conf,
 void free_tls_ctx(struct per_engine_data * const ped)
 {
 #ifndef NO_SERVER
-    dispose_cipher(&ped->dec_tckt);
-    dispose_cipher(&ped->enc_tckt);
+    free_ticket_prot(ped);
+#endif
+#ifdef HAVE_CERT_CACHE
+    free_cert_cache(ped);
 #endif
     ptls_aead_free(ped->rid_ctx);
 
 #if !defined(PARTICLE) && !defined(RIOT_VERSION)
-    // free ticket cache
-    struct tls_ticket * t;
-    struct tls_ticket * tmp;
-    for (t = splay_min(tickets_by_peer, &tickets); t != 0; t = tmp) {
-        tmp = splay_next(tickets_by_peer, &tickets, t);
-        ensure(splay_remove(tickets_by_peer, &tickets, t), "removed");
-        free_ticket(t);
-    }
+    tickets_free();
 #endif
 
     for (size_t i = 0; i < ped->tls_ctx.certificates.count; i++)
@@ -1878,7 +1935,7 @@ uint16_t enc_aead(const struct w_iov * const v,
 
 
 static ptls_hash_context_t * __attribute__((nonnull))
-prep_hash_ctx(const struct q_conn * const c,
+prep_hash_ctx(const struct w_sockaddr * const peer,
               const ptls_cipher_suite_t * const cs)
 {
     // create hash context
@@ -1887,79 +1944,109 @@ prep_hash_ctx(const struct q_conn * const c,
 
     // hash our git commit hash and the peer IP address
     hc->update(hc, quant_commit_hash, quant_commit_hash_len);
-    hc->update(hc, &c->peer, sizeof(c->peer));
+    hc->update(hc, peer, sizeof(*peer));
 
     return hc;
 }
 
 
-void mk_rtry_tok(struct q_conn * const c, const struct cid * const odcid)
+void mk_rtry_tok(const struct w_sockaddr * const peer,
+                 const struct cid * const odcid,
+                 const struct cid * const scid,
+                 const uint8_t type,
+                 uint8_t * const tok,
+                 uint16_t * const tok_len)
 {
     const ptls_cipher_suite_t * const cs = &aes128gcmsha256;
-    ptls_hash_context_t * const hc = prep_hash_ctx(c, cs);
+    ptls_hash_context_t * const hc = prep_hash_ctx(peer, cs);
 
-    // hash current CIDs
+    // hash the token type and current CIDs
+    hc->update(hc, &type, sizeof(type));
     hc->update(hc, &odcid->len, sizeof(odcid->len));
     hc->update(hc, odcid->id, odcid->len);
-    hc->update(hc, &c->scid->len, sizeof(c->scid->len));
-    hc->update(hc, c->scid->id, c->scid->len);
-    hc->final(hc, c->tok, PTLS_HASH_FINAL_MODE_FREE);
-    c->tok_len = (uint16_t)cs->hash->digest_size;
+    hc->update(hc, &scid->len, sizeof(scid->len));
+    hc->update(hc, scid->id, scid->len);
+    hc->final(hc, tok, PTLS_HASH_FINAL_MODE_FREE);
+    *tok_len = (uint16_t)cs->hash->digest_size;
 
-    // append CIDs to hashed token
-    memcpy(&c->tok[c->tok_len], &odcid->len, sizeof(odcid->len));
-    c->tok_len += sizeof(odcid->len);
+    // append type and CIDs to hashed token
+    tok[(*tok_len)++] = type;
+    memcpy(&tok[*tok_len], &odcid->len, sizeof(odcid->len));
+    *tok_len += sizeof(odcid->len);
 
-    memcpy(&c->tok[c->tok_len], odcid->id, odcid->len);
-    c->tok_len += odcid->len;
+    memcpy(&tok[*tok_len], odcid->id, odcid->len);
+    *tok_len += odcid->len;
 
-    memcpy(&c->tok[c->tok_len], &c->scid->len, sizeof(c->scid->len));
-    c->tok_len += sizeof(c->scid->len);
+    memcpy(&tok[*tok_len], &scid->len, sizeof(scid->len));
+    *tok_len += sizeof(scid->len);
 
-    memcpy(&c->tok[c->tok_len], c->scid->id, c->scid->len);
-    c->tok_len += c->scid->len;
+    memcpy(&tok[*tok_len], scid->id, scid->len);
+    *tok_len += scid->len;
 
-    // NOTE: update max_frame_len() when c->tok_len changes
+    // NOTE: update max_frame_len() when the token length changes
 
 #ifdef DEBUG_PROT
     warn(DBG, "computed Retry tok %s",
-         hex2str(c->tok, c->tok_len, (char[hex_str_len(MAX_TOK_LEN)]){""},
-                 hex_str_len(c->tok_len)));
+         hex2str(tok, *tok_len, (char[hex_str_len(MAX_TOK_LEN)]){""},
+                 hex_str_len(*tok_len)));
 #endif
 }
 
 
-bool verify_rtry_tok(struct q_conn * const c,
+bool verify_rtry_tok(struct w_engine * const w,
+                     const struct w_sockaddr * const peer,
                      const uint8_t * const tok,
-                     const uint16_t tok_len)
+                     const uint16_t tok_len,
+                     uint8_t * const type)
 {
     const ptls_cipher_suite_t * const cs = &aes128gcmsha256;
-    ptls_hash_context_t * const hc = prep_hash_ctx(c, cs);
+
+    // this runs before there is a conn, so check the type and CID lengths
+    // encoded in the token, which init_tp() later trusts
+    const size_t dlen = cs->hash->digest_size;
+    if (tok_len < dlen + 3)
+        return false;
+    *type = tok[dlen];
+    if (*type != TOK_RTRY && *type != TOK_NEW)
+        return false;
+    const uint8_t odcid_len = tok[dlen + 1];
+    if (odcid_len > CID_LEN_MAX || tok_len < dlen + 3 + odcid_len)
+        return false;
+    const uint8_t scid_len = tok[dlen + 2 + odcid_len];
+    if (scid_len > CID_LEN_MAX || tok_len != dlen + 3 + odcid_len + scid_len)
+        return false;
+
+    ptls_hash_context_t * const hc = prep_hash_ctx(peer, cs);
 
     // hash current cid included in token
-    unpoison_scratch(ped(c->w)->scratch, ped(c->w)->scratch_len);
-    hc->update(hc, tok + cs->hash->digest_size,
-               tok_len - cs->hash->digest_size);
-    hc->final(hc, ped(c->w)->scratch, PTLS_HASH_FINAL_MODE_FREE);
+    unpoison_scratch(ped(w)->scratch, ped(w)->scratch_len);
+    hc->update(hc, tok + dlen, tok_len - dlen);
+    hc->final(hc, ped(w)->scratch, PTLS_HASH_FINAL_MODE_FREE);
 
 #ifdef DEBUG_PROT
     warn(DBG, "computed Retry tok %s",
-         hex2str(ped(c->w)->scratch, cs->hash->digest_size,
-                 (char[hex_str_len(MAX_TOK_LEN)]){""},
-                 hex_str_len(cs->hash->digest_size)));
-#endif
-    const bool ok = memcmp(ped(c->w)->scratch, tok, cs->hash->digest_size) == 0;
-    if (ok) {
-        c->tok_len = tok_len;
-        memcpy(c->tok, tok + cs->hash->digest_size,
-               tok_len - cs->hash->digest_size);
-    }
-    poison_scratch(ped(c->w)->scratch, ped(c->w)->scratch_len);
+         hex2str(ped(w)->scratch, dlen, (char[hex_str_len(MAX_TOK_LEN)]){""},
+                 hex_str_len(dlen)));
+#endif
+    const bool ok = memcmp(ped(w)->scratch, tok, dlen) == 0;
+    poison_scratch(ped(w)->scratch, ped(w)->scratch_len);
     return ok;
 }
 
 
-void mk_rit(const struct q_conn * const c,
+void use_rtry_tok(struct q_conn * const c,
+                  const uint8_t * const tok,
+                  const uint16_t tok_len)
+{
+    // keep the CIDs from a verified Retry token for the transport parameters
+    const size_t dlen = aes128gcmsha256.hash->digest_size + 1;
+    c->tok_len = (uint16_t)(tok_len - dlen);
+    memcpy(c->tok, tok + dlen, c->tok_len);
+}
+
+
+void mk_rit(struct w_engine * const w,
+            const uint32_t vers,
             const struct cid * const odcid,
             const uint8_t flags,
             const struct cid * const dcid,
@@ -1968,24 +2055,24 @@ void mk_rit(const struct q_conn * const c,
             const uint16_t tok_len,
             uint8_t * const rit)
 {
-    unpoison_scratch(ped(c->w)->scratch, ped(c->w)->scratch_len);
-    uint8_t * pos = ped(c->w)->scratch;
-    uint8_t * end = pos + ped(c->w)->scratch_len;
+    unpoison_scratch(ped(w)->scratch, ped(w)->scratch_len);
+    uint8_t * pos = ped(w)->scratch;
+    uint8_t * end = pos + ped(w)->scratch_len;
 
     // encode the pseudo packet
     enc1(&pos, end, odcid->len);
     encb(&pos, end, odcid->id, odcid->len);
     enc1(&pos, end, flags);
-    enc4(&pos, end, c->vers);
+    enc4(&pos, end, vers);
     enc1(&pos, end, dcid->len);
     encb(&pos, end, dcid->id, dcid->len);
     enc1(&pos, end, scid->len);
     encb(&pos, end, scid->id, scid->len);
     encb(&pos, end, tok, tok_len);
 
-    ptls_aead_encrypt(ped(c->w)->rid_ctx, rit, 0, 0, 0, ped(c->w)->scratch,
-                      (size_t)(pos - ped(c->w)->scratch));
-    poison_scratch(ped(c->w)->scratch, ped(c->w)->scratch_len);
+    ptls_aead_encrypt(ped(w)->rid_ctx, rit, 0, 0, 0, ped(w)->scratch,
+                      (size_t)(pos - ped(w)->scratch));
+    poison_scratch(ped(w)->scratch, ped(w)->scratch_len);
 }
 
 
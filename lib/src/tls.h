@@ -68,6 +68,10 @@ nonrandom_bytes(void * const buf, const size_t len)
 #endif
 #endif
 
+#ifdef HAVE_CERT_COMPRESSION
+#include <picotls/certificate_compression.h>
+#endif
+
 
 struct cipher_ctx {
     ptls_aead_context_t * aead;
@@ -75,6 +79,46 @@ struct cipher_ctx {
 };
 
 
+#ifndef NO_SERVER
+#define TCKT_KEYS 3                   ///< Previous, current and next period.
+#define TCKT_PERIOD (12 * 60 * 60)   ///< Default key rotation period [s].
+#define TCKT_LIFETIME (24 * 60 * 60) ///< Session ticket lifetime [s].
+
+struct tckt_key {
+    struct cipher_ctx enc;
+    struct cipher_ctx dec;
+    uint64_t epoch; ///< Rotation period this key belongs to.
+};
+
+/// Session ticket keys, derived from a secret and the wall-clock rotation
+/// period, so that all processes sharing the secret agree on them.
+struct tckt_ring {
+    struct tckt_key key[TCKT_KEYS];       ///< Indexed by epoch % TCKT_KEYS.
+    uint8_t secret[PTLS_MAX_DIGEST_SIZE]; ///< Hash of the key file.
+    uint64_t epoch;                       ///< Current rotation period.
+    int64_t checked;                      ///< When the key file was checked.
+    int64_t mtime;                        ///< Key file mtime when last read.
+    uint32_t period;                      ///< Rotation period [s].
+    bool stat_failed;                     ///< Warned about the key file?
+    uint8_t _unused[3];
+};
+
+// picotls lets us emit our own Certificate messages since it knows RFC 8879
+#ifdef PTLS_ERROR_DELEGATE
+#define HAVE_CERT_CACHE
+
+/// Pre-encoded server Certificate messages, shared by all handshakes.
+struct cert_cache {
+    ptls_emit_certificate_t super;
+    ptls_iovec_t msg[2]; ///< Without and with the stapled OCSP response.
+#ifdef HAVE_CERT_COMPRESSION
+    ptls_emit_compressed_certificate_t ccert; ///< Brotli-compressed msgs.
+#endif
+};
+#endif
+#endif
+
+
 typedef enum { ep_init = 0, ep_0rtt = 1, ep_hshk = 2, ep_data = 3 } epoch_t;
 
 
@@ -123,14 +167,31 @@ enc_aead(const struct w_iov * const v,
          struct w_iov * const xv,
          const uint16_t pkt_nr_pos);
 
+#define TOK_RTRY 0x00 ///< Token type sent in a Retry.
+#define TOK_NEW 0x01  ///< Token type sent in a NEW_TOKEN frame.
+
 extern void __attribute__((nonnull))
-mk_rtry_tok(struct q_conn * const c, const struct cid * const odcid);
+mk_rtry_tok(const struct w_sockaddr * const peer,
+            const struct cid * const odcid,
+            const struct cid * const scid,
+            const uint8_t type,
+            uint8_t * const tok,
+            uint16_t * const tok_len);
+
+extern bool __attribute__((nonnull))
+verify_rtry_tok(struct w_engine * const w,
+                const struct w_sockaddr * const peer,
+                const uint8_t * const tok,
+                const uint16_t tok_len,
+                uint8_t * const type);
 
-extern bool __attribute__((nonnull)) verify_rtry_tok(struct q_conn * const c,
-                                                     const uint8_t * const tok,
-                                                     const uint16_t tok_len);
+extern void __attribute__((nonnull))
+use_rtry_tok(struct q_conn * const c,
+             const uint8_t * const tok,
+             const uint16_t tok_len);
 
-extern void __attribute__((nonnull)) mk_rit(const struct q_conn * const c,
+extern void __attribute__((nonnull)) mk_rit(struct w_engine * const w,
+                                            const uint32_t vers,
                                             const struct cid * const odcid,
                                             const uint8_t flags,
                                             const struct cid * const dcid,
@@ -0,0 +1,468 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <quant/quant.h>
+
+#ifdef HAVE_LIBURING
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <liburing.h>
+#include <timeout.h>
+
+#include "conn.h"
+#include "quic.h"
+#include "uring.h"
+
+
+#define UR_ENTRIES 1024  ///< Submission queue depth.
+#define UR_RX_BUFS 512   ///< RX buffers lent to the kernel (power of two).
+#define UR_TX_SLOTS 4096 ///< Maximum number of in-flight TX operations.
+#define UR_BGID 0        ///< Buffer group ID of the RX buffer ring.
+#define UR_CMSG_LEN 64   ///< Space reserved for RX control messages.
+
+// the low bits of each user_data identify the operation
+#define UR_OP_RX 1
+#define UR_OP_TX 2
+#define UR_OP_CANCEL 3
+#define UR_OP_MASK 0x7
+#define UR_OP_SHIFT 3
+
+
+struct ur_tx {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_storage sa;
+    union {
+        struct cmsghdr align;
+        uint8_t buf[CMSG_SPACE(sizeof(int))];
+    } cmsg;
+    struct w_iov * v;    ///< Buffer being transmitted, freed on completion.
+    struct ur_tx * next; ///< Free-list linkage.
+};
+
+
+struct uring {
+    struct io_uring ring;
+    struct io_uring_buf_ring * br;
+    struct ur_tx * tx;                  ///< TX slots.
+    struct ur_tx * tx_free;             ///< Unused TX slots.
+    struct w_iov * rx_bufs[UR_RX_BUFS]; ///< Buffer ID to w_iov mapping.
+    struct msghdr rx_msg;               ///< Multishot recvmsg template.
+    uint16_t rx_off;                    ///< Payload offset in RX buffers.
+    uint16_t rx_missing;                ///< RX buffers we failed to replace.
+#if HAVE_64BIT
+    uint8_t _unused[4];
+#endif
+};
+
+
+#define ur(w) (ped(w)->uring)
+
+
+static bool __attribute__((nonnull))
+provide_rx_buf(struct w_engine * const w, const uint16_t bid)
+{
+    struct uring * const u = ur(w);
+    // reserve room for the recvmsg header, so the payload lands on v->buf
+    struct w_iov * const v = w_alloc_iov(w, AF_INET6, 0, u->rx_off);
+    u->rx_bufs[bid] = v;
+    if (unlikely(v == 0))
+        return false;
+
+    io_uring_buf_ring_add(u->br, v->buf - u->rx_off, v->len + u->rx_off, bid,
+                          io_uring_buf_ring_mask(UR_RX_BUFS), 0);
+    io_uring_buf_ring_advance(u->br, 1);
+    return true;
+}
+
+
+static struct io_uring_sqe * __attribute__((nonnull))
+get_sqe(struct uring * const u)
+{
+    struct io_uring_sqe * sqe = io_uring_get_sqe(&u->ring);
+    if (unlikely(sqe == 0)) {
+        // SQ is full, hand what we have to the kernel
+        io_uring_submit(&u->ring);
+        sqe = io_uring_get_sqe(&u->ring);
+        ensure(sqe, "have SQE after submit");
+    }
+    return sqe;
+}
+
+
+static void __attribute__((nonnull))
+arm_rx(struct uring * const u, const int fd)
+{
+    struct io_uring_sqe * const sqe = get_sqe(u);
+    io_uring_prep_recvmsg_multishot(sqe, fd, &u->rx_msg, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = UR_BGID;
+    io_uring_sqe_set_data64(sqe, ((uint64_t)fd << UR_OP_SHIFT) | UR_OP_RX);
+}
+
+
+bool uring_init(struct w_engine * const w)
+{
+    struct uring * const u = calloc(1, sizeof(*u));
+    ensure(u, "could not calloc");
+
+    int ret = io_uring_queue_init(UR_ENTRIES, &u->ring, 0);
+    if (ret < 0) {
+        warn(WRN, "io_uring_queue_init: %s", strerror(-ret));
+        goto fail;
+    }
+
+    u->br = io_uring_setup_buf_ring(&u->ring, UR_RX_BUFS, UR_BGID, 0, &ret);
+    if (u->br == 0) {
+        warn(WRN, "io_uring_setup_buf_ring: %s", strerror(-ret));
+        io_uring_queue_exit(&u->ring);
+        goto fail;
+    }
+
+    u->rx_msg.msg_namelen = sizeof(struct sockaddr_in6);
+    u->rx_msg.msg_controllen = UR_CMSG_LEN;
+    u->rx_off = (uint16_t)(sizeof(struct io_uring_recvmsg_out) +
+                           u->rx_msg.msg_namelen + u->rx_msg.msg_controllen);
+
+    u->tx = calloc(UR_TX_SLOTS, sizeof(*u->tx));
+    ensure(u->tx, "could not calloc");
+    for (uint32_t i = 0; i < UR_TX_SLOTS; i++) {
+        u->tx[i].next = u->tx_free;
+        u->tx_free = &u->tx[i];
+    }
+
+    ped(w)->uring = u;
+    for (uint16_t bid = 0; bid < UR_RX_BUFS; bid++)
+        if (unlikely(provide_rx_buf(w, bid) == false)) {
+            warn(WRN, "cannot lend %u RX bufs to io_uring", UR_RX_BUFS);
+            uring_cleanup(w);
+            return false;
+        }
+
+    warn(NTE, "using io_uring with %u RX bufs, %u TX slots", UR_RX_BUFS,
+         UR_TX_SLOTS);
+    return true;
+
+fail:
+    free(u);
+    return false;
+}
+
+
+void uring_cleanup(struct w_engine * const w)
+{
+    struct uring * const u = ur(w);
+
+    // after this, the kernel no longer references any of our buffers
+    io_uring_free_buf_ring(&u->ring, u->br, UR_RX_BUFS, UR_BGID);
+    io_uring_queue_exit(&u->ring);
+
+    for (uint16_t bid = 0; bid < UR_RX_BUFS; bid++)
+        if (u->rx_bufs[bid])
+            w_free_iov(u->rx_bufs[bid]);
+    for (uint32_t i = 0; i < UR_TX_SLOTS; i++)
+        if (u->tx[i].v)
+            w_free_iov(u->tx[i].v);
+
+    free(u->tx);
+    free(u);
+    ped(w)->uring = 0;
+}
+
+
+void uring_add_sock(struct w_sock * const ws)
+{
+    struct uring * const u = ur(ws->w);
+    arm_rx(u, w_fd(ws));
+    // an external event loop may only poll the ring fd, so don't wait for
+    // the next RX or timer pass to submit
+    io_uring_submit(&u->ring);
+}
+
+
+void uring_del_sock(struct w_sock * const ws)
+{
+    struct uring * const u = ur(ws->w);
+    const int fd = w_fd(ws);
+    struct io_uring_sqe * const sqe = get_sqe(u);
+    io_uring_prep_cancel64(sqe, ((uint64_t)fd << UR_OP_SHIFT) | UR_OP_RX, 0);
+    io_uring_sqe_set_data64(sqe, ((uint64_t)fd << UR_OP_SHIFT) | UR_OP_CANCEL);
+    // the cancel must reach the kernel before the fd is closed and reused
+    io_uring_submit(&u->ring);
+}
+
+
+int uring_fd(const struct w_engine * const w)
+{
+    return ur(w)->ring.ring_fd;
+}
+
+
+static void __attribute__((nonnull))
+rx_meta(struct w_iov * const v,
+        struct io_uring_recvmsg_out * const o,
+        struct msghdr * const msg)
+{
+    const struct sockaddr * const sa = io_uring_recvmsg_name(o);
+    if (likely(o->namelen)) {
+        w_to_waddr(&v->saddr.addr, sa);
+        // sin_port and sin6_port are at the same offset
+        v->saddr.port =
+            ((const struct sockaddr_in *)(const void *)sa)->sin_port;
+    }
+
+    v->flags = v->ttl = 0;
+    for (struct cmsghdr * cm = io_uring_recvmsg_cmsg_firsthdr(o, msg); cm;
+         cm = io_uring_recvmsg_cmsg_nexthdr(o, msg, cm)) {
+        if ((cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_TOS) ||
+            (cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_TCLASS))
+            // IP_TOS is a byte, IPV6_TCLASS an int; either way the low byte
+            v->flags = *CMSG_DATA(cm);
+        else if ((cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_TTL) ||
+                 (cm->cmsg_level == IPPROTO_IPV6 &&
+                  cm->cmsg_type == IPV6_HOPLIMIT)) {
+            int ttl;
+            memcpy(&ttl, CMSG_DATA(cm), sizeof(ttl));
+            v->ttl = (uint8_t)ttl;
+        }
+    }
+}
+
+
+static struct w_sock * __attribute__((nonnull))
+sock_by_fd(struct w_engine * const w, const int fd)
+{
+    const khiter_t k = kh_get(socks_by_fd, &ped(w)->socks_by_fd, fd);
+    return k == kh_end(&ped(w)->socks_by_fd)
+               ? 0
+               : kh_val(&ped(w)->socks_by_fd, k);
+}
+
+
+static struct w_iov * __attribute__((nonnull))
+rx_cqe(struct w_engine * const w,
+       const struct io_uring_cqe * const cqe,
+       struct w_sock ** const ws)
+{
+    struct uring * const u = ur(w);
+    const int fd = (int)(cqe->user_data >> UR_OP_SHIFT);
+    *ws = sock_by_fd(w, fd);
+
+    // the kernel terminates a multishot recv on error or when out of bufs
+    if ((cqe->flags & IORING_CQE_F_MORE) == 0 && *ws && cqe->res != -ECANCELED)
+        arm_rx(u, fd);
+
+    if (unlikely(cqe->res < 0)) {
+        if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+            warn(ERR, "recvmsg on fd %d: %s", fd, strerror(-cqe->res));
+        return 0;
+    }
+
+    ensure(cqe->flags & IORING_CQE_F_BUFFER, "have buffer");
+    const uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    struct w_iov * const v = u->rx_bufs[bid];
+    if (unlikely(provide_rx_buf(w, bid) == false))
+        u->rx_missing++;
+
+    struct io_uring_recvmsg_out * const o = io_uring_recvmsg_validate(
+        v->buf - u->rx_off, cqe->res, &u->rx_msg);
+    if (unlikely(*ws == 0 || o == 0 || (o->flags & MSG_TRUNC))) {
+        w_free_iov(v);
+        return 0;
+    }
+
+    v->len = (uint16_t)io_uring_recvmsg_payload_length(o, cqe->res, &u->rx_msg);
+    rx_meta(v, o, &u->rx_msg);
+    return v;
+}
+
+
+static void __attribute__((nonnull))
+tx_cqe(struct uring * const u, const struct io_uring_cqe * const cqe)
+{
+    struct ur_tx * const t =
+        (struct ur_tx *)(uintptr_t)(cqe->user_data & ~(uint64_t)UR_OP_MASK);
+    if (unlikely(cqe->res < 0))
+        warn(ERR, "sendmsg: %s", strerror(-cqe->res));
+    w_free_iov(t->v);
+    t->v = 0;
+    t->next = u->tx_free;
+    u->tx_free = t;
+}
+
+
+bool uring_rx(struct w_engine * const w, const uint64_t nsec)
+{
+    struct uring * const u = ur(w);
+
+    // retry lending buffers we could not replace earlier
+    for (uint16_t bid = 0; unlikely(u->rx_missing) && bid < UR_RX_BUFS; bid++)
+        if (u->rx_bufs[bid] == 0 && provide_rx_buf(w, bid))
+            u->rx_missing--;
+
+    struct io_uring_cqe * cqe;
+    if (nsec == 0) {
+        io_uring_submit(&u->ring);
+        if (io_uring_peek_cqe(&u->ring, &cqe) != 0)
+            return false;
+    } else {
+        struct __kernel_timespec ts = {.tv_sec = (long long)(nsec / NS_PER_S),
+                                       .tv_nsec = (long long)(nsec % NS_PER_S)};
+        if (io_uring_submit_and_wait_timeout(&u->ring, &cqe, 1,
+                                             nsec == UINT64_MAX ? 0 : &ts,
+                                             0) < 0)
+            return false;
+    }
+
+    // this actually matters
+    timeouts_update(ped(w)->wheel, w_now());
+
+    // batch consecutive packets for the same w_sock into one rx() pass
+    struct w_iov_sq x = w_iov_sq_initializer(x);
+    struct w_sock * x_ws = 0;
+    bool got_rx = false;
+    while (io_uring_peek_cqe(&u->ring, &cqe) == 0) {
+        struct w_sock * ws = 0;
+        struct w_iov * v = 0;
+        switch (cqe->user_data & UR_OP_MASK) {
+        case UR_OP_RX:
+            v = rx_cqe(w, cqe, &ws);
+            break;
+        case UR_OP_TX:
+            tx_cqe(u, cqe);
+            break;
+        default:
+            break;
+        }
+        io_uring_cqe_seen(&u->ring, cqe);
+
+        if (v == 0)
+            continue;
+        if (ws != x_ws && x_ws) {
+            rx_batch(x_ws, &x);
+            sq_init(&x);
+        }
+        x_ws = ws;
+        sq_insert_tail(&x, v, next);
+        got_rx = true;
+    }
+    if (x_ws)
+        rx_batch(x_ws, &x);
+
+    uring_flush(w);
+    return got_rx;
+}
+
+
+static void __attribute__((nonnull))
+prep_tx(struct w_sock * const ws,
+        struct ur_tx * const t,
+        struct w_iov * const v)
+{
+    t->v = v;
+    t->iov = (struct iovec){.iov_base = v->buf, .iov_len = v->len};
+    t->msg = (struct msghdr){.msg_iov = &t->iov, .msg_iovlen = 1};
+
+    if (w_connected(ws) == false) {
+        memset(&t->sa, 0, sizeof(t->sa));
+        if (v->saddr.addr.af == AF_INET) {
+            struct sockaddr_in * const sin4 = (struct sockaddr_in *)&t->sa;
+            sin4->sin_family = AF_INET;
+            sin4->sin_port = v->saddr.port;
+            memcpy(&sin4->sin_addr, &v->saddr.addr.ip4,
+                   sizeof(sin4->sin_addr));
+            t->msg.msg_namelen = sizeof(*sin4);
+        } else {
+            struct sockaddr_in6 * const sin6 = (struct sockaddr_in6 *)&t->sa;
+            sin6->sin6_family = AF_INET6;
+            sin6->sin6_port = v->saddr.port;
+            memcpy(&sin6->sin6_addr, &v->saddr.addr.ip6,
+                   sizeof(sin6->sin6_addr));
+            t->msg.msg_namelen = sizeof(*sin6);
+        }
+        t->msg.msg_name = &t->sa;
+    }
+
+#ifndef NO_ECN
+    if (v->flags & ECN_MASK) {
+        t->msg.msg_control = t->cmsg.buf;
+        t->msg.msg_controllen = sizeof(t->cmsg.buf);
+        struct cmsghdr * const cm = CMSG_FIRSTHDR(&t->msg);
+        cm->cmsg_level = ws->ws_af == AF_INET ? IPPROTO_IP : IPPROTO_IPV6;
+        cm->cmsg_type = ws->ws_af == AF_INET ? IP_TOS : IPV6_TCLASS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        const int tos = v->flags & ECN_MASK;
+        memcpy(CMSG_DATA(cm), &tos, sizeof(tos));
+    }
+#endif
+}
+
+
+void uring_tx(struct w_sock * const ws, struct w_iov_sq * const q)
+{
+    struct uring * const u = ur(ws->w);
+    const int fd = w_fd(ws);
+
+    while (!sq_empty(q) && likely(u->tx_free)) {
+        struct w_iov * const v = sq_first(q);
+        sq_remove_head(q, next);
+
+        struct ur_tx * const t = u->tx_free;
+        u->tx_free = t->next;
+        prep_tx(ws, t, v);
+
+        struct io_uring_sqe * const sqe = get_sqe(u);
+        io_uring_prep_sendmsg(sqe, fd, &t->msg, 0);
+        io_uring_sqe_set_data64(sqe, (uint64_t)(uintptr_t)t | UR_OP_TX);
+    }
+
+    if (unlikely(!sq_empty(q))) {
+        // out of TX slots, send the remainder synchronously
+        warn(DBG, "io_uring TX slots exhausted, %" PRIu " pkts via sockets",
+             w_iov_sq_cnt(q));
+        w_tx(ws, q);
+        w_nic_tx(ws->w);
+    }
+}
+
+
+void uring_flush(struct w_engine * const w)
+{
+    struct uring * const u = ur(w);
+    if (io_uring_sq_ready(&u->ring))
+        io_uring_submit(&u->ring);
+}
+
+#endif
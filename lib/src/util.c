@@ -25,8 +25,15 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <inttypes.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include <unistd.h>
 
 #include <quant/quant.h>
@@ -73,23 +80,61 @@ void q_write_str(struct w_engine * const w,
 }
 
 
-void q_write_file(struct w_engine * const w,
+void q_write_file(struct w_engine * const w __attribute__((unused)),
                   struct q_stream * const s,
                   const int f,
-                  const size_t len,
+                  size_t len,
                   const bool fin)
 {
-    // allocate tail queue
+    ensure(s->src == 0, "strm " FMT_SID " already has a lazy source", s->id);
     struct w_iov_sq o = w_iov_sq_initializer(o);
-    q_alloc(w, &o, s->c, q_conn_af(s->c), len);
 
-    struct w_iov * v;
-    sq_foreach (v, &o, next) {
-        const ssize_t ret = read(f, v->buf, v->len);
-        ensure(ret != -1, "cannot read");
+    // never map past the end of a regular file, touching it would SIGBUS
+    struct stat st;
+    const off_t pos = lseek(f, 0, SEEK_CUR);
+    const bool is_reg = fstat(f, &st) == 0 && S_ISREG(st.st_mode);
+    if (is_reg && pos != -1 && len > (size_t)MAX(st.st_size - pos, 0)) {
+        warn(WRN, "fd %d has only %" PRId64 " of %zu bytes left", f,
+             (int64_t)MAX(st.st_size - pos, 0), len);
+        len = (size_t)MAX(st.st_size - pos, 0);
     }
 
-    // write it and free tail queue and iov
-    q_write(s, &o, fin);
-    q_free(&o);
+    if (len == 0) {
+        q_write(s, &o, fin);
+        return;
+    }
+
+    // this validates the conn and stream state and kicks the TX watcher
+    if (q_write(s, &o, false) == false)
+        return;
+
+    struct strm_src * const src = calloc(1, sizeof(*src));
+    ensure(src, "could not calloc");
+    src->len = len;
+    src->fin = fin;
+
+    // map the file, so data is copied from the page cache as cwnd allows
+    if (is_reg && pos != -1) {
+        const size_t pg_off = (size_t)pos % (size_t)sysconf(_SC_PAGESIZE);
+        void * const map = mmap(0, pg_off + len, PROT_READ, MAP_PRIVATE, f,
+                                pos - (off_t)pg_off);
+        if (map != MAP_FAILED) {
+            madvise(map, pg_off + len, MADV_SEQUENTIAL);
+            src->map = map;
+            src->map_len = pg_off + len;
+            src->data = src->map + pg_off;
+            // leave the file position where read() would have
+            lseek(f, (off_t)len, SEEK_CUR);
+        }
+    }
+
+    if (src->map == 0) {
+        // not blocking: if f runs dry, call q_resume_fill() once it is readable
+        warn(DBG, "cannot mmap fd %d, will read() lazily", f);
+        src->fd = dup(f);
+        ensure(src->fd != -1, "cannot dup");
+    }
+
+    s->src = src;
+    s->lazy_out = true;
 }
@@ -28,6 +28,7 @@
 #include <net/if.h>
 #include <sys/socket.h>
 #include <utility>
+#include <vector>
 
 #include <benchmark/benchmark.h>
 #include <quant/quant.h>
@@ -40,9 +41,14 @@ extern "C" {
 
 #include "cid.h"
 #include "conn.h" // IWYU pragma: keep
+#include "diet.h"
+#include "frame.h"
+#include "marshall.h"
 #include "pkt.h"
 #include "pn.h" // IWYU pragma: keep
 #include "quic.h"
+#include "recovery.h"
+#include "stream.h"
 #include "tls.h" // IWYU pragma: keep
 
 #ifdef __cplusplus
@@ -51,6 +57,7 @@ extern "C" {
 
 
 static struct q_conn * c;
+static struct q_stream * s;
 static struct w_engine * w;
 
 
@@ -86,6 +93,362 @@ BENCHMARK(BM_quic_encryption)->RangeMultiplier(2)->Ranges({{16, 1500}, {0, 1}})
     ;
 
 
+static void untx(struct pkt_meta * const m)
+{
+    // undo what enc_pkt() did, so its w_iov and m can encode the next pkt
+    struct w_iov * const xv = sq_first(&c->txq);
+    sq_remove_head(&c->txq, next);
+    w_free_iov(xv);
+    m->strm = nullptr;
+    on_pkt_lost(m, false);
+    memset(m, 0, sizeof(*m));
+    // enc_pkt() has already moved the w_iov back to its stream data
+    m->strm_data_pos = DATA_OFFSET;
+}
+
+
+static uint16_t mk_pkt(uint8_t * const buf, const uint16_t len)
+{
+    // encode a 1-RTT pkt with len bytes of stream data into buf
+    struct pkt_meta * m;
+    struct w_iov * const v = alloc_iov(w, AF_INET, len, DATA_OFFSET, &m);
+    rand_bytes(v->buf, len);
+    ensure(enc_pkt(s, false, true, false, false, v, m), "enc_pkt");
+    const struct w_iov * const xv = sq_first(&c->txq);
+    const uint16_t pkt_len = xv->len;
+    memcpy(buf, xv->buf, pkt_len);
+    untx(m);
+    free_iov(v, m);
+    return pkt_len;
+}
+
+
+static void BM_enc_pkt(benchmark::State & state)
+{
+    const auto len = uint16_t(state.range(0));
+
+    struct pkt_meta * m;
+    struct w_iov * const v = alloc_iov(w, AF_INET, len, DATA_OFFSET, &m);
+    rand_bytes(v->buf, len);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(enc_pkt(s, false, true, false, false, v, m));
+        untx(m);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()));
+    state.SetBytesProcessed(int64_t(state.iterations() * len)); // NOLINT
+
+    free_iov(v, m);
+}
+
+
+BENCHMARK(BM_enc_pkt)->RangeMultiplier(4)->Range(16, 1024);
+
+
+static void BM_dec_pkt_hdr(benchmark::State & state)
+{
+    const auto len = uint16_t(state.range(0));
+    const bool remainder = state.range(1);
+
+    uint8_t pkt[MAX_UPS];
+    const uint16_t pkt_len = mk_pkt(pkt, len);
+
+    struct pkt_meta * m;
+    struct w_iov * const v = alloc_iov(w, AF_INET, 0, 0, &m);
+    struct w_iov * const xv = w_alloc_iov(w, AF_INET, 0, 0);
+    struct w_iov_sq x = w_iov_sq_initializer(x);
+    uint8_t tok[MAX_TOK_LEN];
+    uint16_t tok_len = 0;
+    uint8_t rit[RIT_LEN];
+    bool decoal = false;
+
+    for (auto _ : state) {
+        // the remainder undoes HP and decrypts in place, so restore the pkt
+        memcpy(xv->buf, pkt, pkt_len);
+        xv->len = pkt_len;
+        memset(m, 0, sizeof(*m));
+        benchmark::DoNotOptimize(dec_pkt_hdr_beginning(
+            xv, v, m, &x, false, tok, &tok_len, rit, c->dcid->len, &decoal));
+        if (remainder)
+            benchmark::DoNotOptimize(dec_pkt_hdr_remainder(xv, v, m, c));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()));
+    state.SetBytesProcessed(int64_t(state.iterations() * pkt_len)); // NOLINT
+
+    w_free_iov(xv);
+    free_iov(v, m);
+}
+
+
+BENCHMARK(BM_dec_pkt_hdr)->RangeMultiplier(4)->Ranges({{16, 1024}, {0, 1}});
+
+
+static void enc_ack(uint8_t ** pos,
+                    const uint8_t * const end,
+                    const uint_t lg_ack,
+                    const uint_t rng_cnt)
+{
+    // encode an ACK of rng_cnt ranges of four pkts each, with gaps of two
+    enc1(pos, end, FRM_ACK);
+    encv(pos, end, lg_ack);
+    encv(pos, end, 0);
+    encv(pos, end, rng_cnt - 1);
+    encv(pos, end, 3);
+    for (uint_t r = 1; r < rng_cnt; r++) {
+        encv(pos, end, 1);
+        encv(pos, end, 3);
+    }
+
+    // mark those pkts as already ACKed, so decoding has no side effects
+    struct pn_space * const pn = &c->pns[pn_data];
+    for (uint_t r = 0; r < rng_cnt; r++)
+        for (uint_t a = 0; a < 4; a++)
+            diet_insert(&pn->acked_or_lost, lg_ack - r * 6 - a, 0);
+}
+
+
+static void BM_dec_frames(benchmark::State & state)
+{
+    const auto mix = state.range(0);
+
+    struct pkt_meta * m;
+    struct w_iov * const v = alloc_iov(w, AF_INET, 0, 0, &m);
+    uint8_t * const buf = v->buf;
+    uint8_t * pos = buf;
+    const uint8_t * const end = buf + c->rec.max_ups - AEAD_LEN;
+
+    // the ACKed pkt nrs are well above anything the other benchmarks send
+    const uint_t lg_ack = 1000000;
+    switch (mix) {
+    case 0:
+        // pure ACK, as sent by a data receiver
+        enc_ack(&pos, end, lg_ack, 8);
+        break;
+
+    case 1:
+        // ACK plus a full-size STREAM frame, as in a bidirectional transfer
+        enc_ack(&pos, end, lg_ack, 2);
+        enc1(&pos, end, FRM_STR | F_STREAM_OFF | F_STREAM_LEN);
+        encv(&pos, end, (uint_t)s->id);
+        encv(&pos, end, 0);
+        encv(&pos, end, 1000);
+        rand_bytes(pos, 1000);
+        pos += 1000;
+        break;
+
+    default:
+        // ACK with flow control updates and a PING, padded to a small pkt
+        enc_ack(&pos, end, lg_ack, 2);
+        enc1(&pos, end, FRM_MCD);
+        encv(&pos, end, c->tp_peer.max_data);
+        enc1(&pos, end, FRM_MSD);
+        encv(&pos, end, (uint_t)s->id);
+        encv(&pos, end, s->out_data_max);
+        enc1(&pos, end, FRM_PNG);
+        memset(pos, FRM_PAD, 64);
+        pos += 64;
+        break;
+    }
+    const auto len = uint16_t(pos - buf);
+
+    for (auto _ : state) {
+        // dec_frames() adjusts v to the stream data, if there is any
+        v->buf = buf;
+        v->len = len;
+        memset(m, 0, sizeof(*m));
+        m->hdr.type = m->hdr.flags = SH;
+        m->pn = &c->pns[pn_data];
+        struct w_iov * vv = v;
+        struct pkt_meta * mm = m;
+        benchmark::DoNotOptimize(dec_frames(c, &vv, &mm));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()));
+    state.SetBytesProcessed(int64_t(state.iterations() * len)); // NOLINT
+
+    v->buf = buf;
+    free_iov(v, m);
+}
+
+
+BENCHMARK(BM_dec_frames)->DenseRange(0, 2);
+
+
+static void BM_enc_ack_frame(benchmark::State & state)
+{
+    const auto rng_cnt = uint_t(state.range(0));
+
+    struct pn_space * const pn = &c->pns[pn_data];
+    for (uint_t r = 0; r < rng_cnt; r++)
+        for (uint_t a = 0; a < 4; a++)
+            diet_insert(&pn->recv, r * 6 + a, w_now());
+
+    uint8_t buf[MAX_UPS];
+    struct pkt_meta m = {};
+    m.hdr.type = SH;
+    int64_t len = 0;
+    for (auto _ : state) {
+        uint8_t * pos = buf;
+        benchmark::DoNotOptimize(enc_ack_frame(
+#ifndef NO_QINFO
+            &c->i,
+#else
+            nullptr,
+#endif
+            &pos, buf, buf + sizeof(buf), &m, pn));
+        len = pos - buf;
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()));
+    state.SetBytesProcessed(int64_t(state.iterations()) * len);
+
+    diet_free(&pn->recv);
+}
+
+
+BENCHMARK(BM_enc_ack_frame)->RangeMultiplier(4)->Range(1, 256);
+
+
+#define VARINTS 1024
+
+static void BM_encv(benchmark::State & state)
+{
+    // values that need the given encoded length (1, 2, 4 or 8 bytes)
+    const auto vlen = uint8_t(state.range(0));
+    const uint64_t max = UINT64_C(1) << (vlen * 8 - 2);
+    uint64_t val[VARINTS];
+    for (auto & v : val)
+        v = (max >> 1) + w_rand_uniform32(UINT32_MAX) % (max >> 1);
+
+    uint8_t buf[VARINTS * sizeof(uint64_t)];
+    for (auto _ : state) {
+        uint8_t * pos = buf;
+        for (const auto v : val)
+            encv(&pos, buf + sizeof(buf), v);
+        benchmark::DoNotOptimize(pos);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * VARINTS));
+    state.SetBytesProcessed(int64_t(state.iterations() * VARINTS * vlen));
+}
+
+
+BENCHMARK(BM_encv)->RangeMultiplier(2)->Range(1, 8);
+
+
+static void BM_decv(benchmark::State & state)
+{
+    const auto vlen = uint8_t(state.range(0));
+    const uint64_t max = UINT64_C(1) << (vlen * 8 - 2);
+    uint8_t buf[VARINTS * sizeof(uint64_t)];
+    uint8_t * pos = buf;
+    for (uint_t i = 0; i < VARINTS; i++)
+        encv(&pos, buf + sizeof(buf),
+             (max >> 1) + w_rand_uniform32(UINT32_MAX) % (max >> 1));
+    const uint8_t * const end = pos;
+
+    for (auto _ : state) {
+        const uint8_t * p = buf;
+        uint64_t v = 0;
+        while (p < end)
+            decv(&v, &p, end);
+        benchmark::DoNotOptimize(v);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * VARINTS));
+    state.SetBytesProcessed(int64_t(state.iterations() * VARINTS * vlen));
+}
+
+
+BENCHMARK(BM_decv)->RangeMultiplier(2)->Range(1, 8);
+
+
+static void BM_diet(benchmark::State & state)
+{
+    // insert n pkt nrs with some reordering and loss, then remove them again
+    const auto n = uint_t(state.range(0));
+    std::vector<uint_t> nrs;
+    for (uint_t i = 0; i < n; i++)
+        if (w_rand_uniform32(100) >= 2)
+            nrs.push_back(i);
+    for (size_t i = 0; i + 1 < nrs.size(); i++)
+        if (w_rand_uniform32(100) < 5)
+            std::swap(nrs[i], nrs[i + 1]);
+
+    struct diet d = diet_initializer(d);
+    for (auto _ : state) {
+        for (const auto nr : nrs)
+            diet_insert(&d, nr, 0);
+        for (const auto nr : nrs)
+            diet_remove(&d, nr);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * nrs.size() * 2));
+    state.SetBytesProcessed(
+        int64_t(state.iterations() * nrs.size() * 2 * sizeof(uint_t)));
+
+    diet_free(&d);
+}
+
+
+BENCHMARK(BM_diet)->RangeMultiplier(8)->Range(8, 4096);
+
+
+static void BM_coalesce(benchmark::State & state)
+{
+    // a queue of Initial, Handshake and 1-RTT pkts, as during a handshake
+    const auto n = uint16_t(state.range(0));
+    static const struct {
+        uint8_t flags;
+        uint16_t len;
+    } pkts[] = {{LH | LH_INIT, 150}, {LH | LH_HSHK, 900}, {SH, 60}};
+
+    int64_t bytes = 0;
+    for (auto _ : state) {
+        // this includes the w_iov allocation, which coalesce() partly frees
+        struct w_iov_sq q = w_iov_sq_initializer(q);
+        for (uint16_t i = 0; i < n; i++) {
+            struct w_iov * const v = w_alloc_iov(w, AF_INET, 0, 0);
+            uint8_t * pos = v->buf;
+            enc1(&pos, v->buf + v->len, pkts[i % 3].flags);
+            enc4(&pos, v->buf + v->len, c->vers);
+            v->len = pkts[i % 3].len;
+            bytes += v->len;
+            sq_insert_tail(&q, v, next);
+        }
+        benchmark::DoNotOptimize(coalesce(&q, c->rec.max_ups, false));
+        w_free(&q);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * n));
+    state.SetBytesProcessed(bytes);
+}
+
+
+BENCHMARK(BM_coalesce)->RangeMultiplier(2)->Range(3, 48);
+
+
+static void BM_xor_hp(benchmark::State & state)
+{
+    uint8_t pkt[MAX_UPS];
+    struct w_iov * const xv = w_alloc_iov(w, AF_INET, 0, 0);
+    xv->len = mk_pkt(pkt, 64);
+    memcpy(xv->buf, pkt, xv->len);
+
+    struct pkt_meta m = {};
+    m.hdr.flags = SH;
+    const struct cipher_ctx * const ctx = &c->pns[pn_data].data.in_1rtt[0];
+    const auto pkt_nr_pos = uint16_t(1 + c->dcid->len);
+
+    for (auto _ : state)
+        // toggles HP on and off, which is the same amount of work
+        benchmark::DoNotOptimize(xor_hp(xv, &m, ctx, pkt_nr_pos, nullptr));
+    state.SetItemsProcessed(int64_t(state.iterations()));
+    // the HP sample plus the protected flags and pkt nr bytes
+    state.SetBytesProcessed(int64_t(state.iterations() *
+                                    (AEAD_LEN + 1 + MAX_PKT_NR_LEN)));
+
+    w_free_iov(xv);
+}
+
+
+BENCHMARK(BM_xor_hp);
+
+
 // BENCHMARK_MAIN()
 
 int main(int argc, char ** argv)
@@ -106,7 +469,22 @@ int main(int argc, char ** argv)
     memcpy(cid.id, "1234", cid.len);
     c = new_conn(w, 0, &cid, &cid, nullptr, "", bswap16(55555), nullptr);
     init_tls(c, "", nullptr);
+
+    // reuse the Initial keys as 1-RTT keys in both directions, so that pkts
+    // we encode can be decoded again
+    struct pn_data * const pnd = &c->pns[pn_data].data;
+    pnd->out_1rtt[0] = pnd->in_1rtt[0] = c->pns[pn_init].early.out;
+
+    // a stream without flow control limits
+    s = new_stream(c, 0);
+    s->out_data_max = s->in_data_max = UINT32_MAX;
+    // for dec_frames(), make any received stream data a duplicate
+    s->in_data_off = UINT32_MAX / 2;
+
     benchmark::RunSpecifiedBenchmarks();
 
+    // these are aliases of the Initial keys, don't free them twice
+    memset(&pnd->out_1rtt[0], 0, sizeof(pnd->out_1rtt[0]));
+    memset(&pnd->in_1rtt[0], 0, sizeof(pnd->in_1rtt[0]));
     q_cleanup(w);
 }
@@ -23,14 +23,23 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
+#include <algorithm>
 #include <arpa/inet.h>
+#include <atomic>
 #include <cinttypes>
 #include <cstdint>
+#include <ctime>
 #include <fcntl.h>
 #include <libgen.h>
+#include <map>
 #include <netinet/in.h>
+#include <poll.h>
+#include <random>
 #include <sys/socket.h>
+#include <thread>
+#include <unordered_set>
 #include <unistd.h>
+#include <vector>
 
 #include <benchmark/benchmark.h>
 #include <quant/quant.h>
@@ -128,6 +137,292 @@ BENCHMARK(BM_conn)->RangeMultiplier(2)->Range(1024, 1024 * 1024 * 32)
     ;
 
 
+#define SERV_PORT 55555
+#define RELAY_PORT 55556
+
+
+// UDP relay between the clients and the server that emulates RTT, loss and
+// reordering, so the matrix below can run over loopback.
+class relay {
+  public:
+    std::atomic<uint64_t> rtt_ns{0};
+    std::atomic<uint32_t> loss_pm{0};    ///< Loss rate, per mille.
+    std::atomic<uint32_t> reorder_pm{0}; ///< Reorder rate, per mille.
+
+  private:
+    struct dgram {
+        int fd;
+        struct sockaddr_in6 to;
+        std::vector<uint8_t> buf;
+    };
+
+    struct path {
+        struct sockaddr_in6 clnt; ///< Client address.
+        int fd;                   ///< Our socket towards the server.
+    };
+
+    int fd_c = -1; ///< Our socket towards the clients.
+    std::vector<path> paths;
+    std::multimap<uint64_t, dgram> q; ///< Datagrams by release time.
+    std::mt19937 rng{1};              ///< Fixed seed, for repeatable runs.
+    std::atomic<bool> stop{false};
+    std::thread thr;
+
+    static uint64_t now()
+    {
+        struct timespec ts = {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * NS_PER_S + uint64_t(ts.tv_nsec);
+    }
+
+    static int mk_sock(const uint16_t port)
+    {
+        const int fd = socket(AF_INET6, SOCK_DGRAM, 0);
+        ensure(fd >= 0, "socket");
+        struct sockaddr_in6 a = {};
+        a.sin6_family = AF_INET6;
+        a.sin6_port = bswap16(port);
+        a.sin6_addr = in6addr_loopback;
+        ensure(bind(fd, reinterpret_cast<struct sockaddr *>(&a), // NOLINT
+                    sizeof(a)) == 0,
+               "bind");
+        return fd;
+    }
+
+    void enqueue(const int fd,
+                 const struct sockaddr_in6 & to,
+                 const uint8_t * const buf,
+                 const size_t len)
+    {
+        if (std::uniform_int_distribution<uint32_t>(0, 999)(rng) <
+            loss_pm.load())
+            return;
+
+        // reordered datagrams are held back by an extra quarter RTT
+        uint64_t t = now() + rtt_ns.load() / 2;
+        if (std::uniform_int_distribution<uint32_t>(0, 999)(rng) <
+            reorder_pm.load())
+            t += rtt_ns.load() / 4 + NS_PER_MS;
+        q.emplace(t, dgram{fd, to, std::vector<uint8_t>(buf, buf + len)});
+    }
+
+    void run()
+    {
+        uint8_t buf[65536];
+        struct sockaddr_in6 serv = {};
+        serv.sin6_family = AF_INET6;
+        serv.sin6_port = bswap16(SERV_PORT);
+        serv.sin6_addr = in6addr_loopback;
+
+        while (stop.load() == false) {
+            // release what is due
+            const uint64_t t = now();
+            while (q.empty() == false && q.begin()->first <= t) {
+                const dgram & d = q.begin()->second;
+                sendto(d.fd, d.buf.data(), d.buf.size(), 0,
+                       reinterpret_cast<const struct sockaddr *>( // NOLINT
+                           &d.to),
+                       sizeof(d.to));
+                q.erase(q.begin());
+            }
+
+            std::vector<struct pollfd> fds = {{fd_c, POLLIN, 0}};
+            for (const auto & p : paths)
+                fds.push_back({p.fd, POLLIN, 0});
+            const int to =
+                q.empty() ? 10
+                          : int((q.begin()->first - std::min(q.begin()->first,
+                                                              now())) /
+                                NS_PER_MS);
+            if (poll(fds.data(), fds.size(), to) <= 0)
+                continue;
+
+            if (fds[0].revents & POLLIN) {
+                struct sockaddr_in6 from = {};
+                socklen_t from_len = sizeof(from);
+                const ssize_t n =
+                    recvfrom(fd_c, buf, sizeof(buf), 0,
+                             reinterpret_cast<struct sockaddr *>( // NOLINT
+                                 &from),
+                             &from_len);
+                if (n > 0) {
+                    // each client socket gets its own path to the server
+                    size_t i = 0;
+                    while (i < paths.size() &&
+                           paths[i].clnt.sin6_port != from.sin6_port)
+                        i++;
+                    if (i == paths.size())
+                        paths.push_back({from, mk_sock(0)});
+                    enqueue(paths[i].fd, serv, buf, size_t(n));
+                }
+            }
+
+            for (size_t i = 1; i < fds.size(); i++)
+                if (fds[i].revents & POLLIN) {
+                    const ssize_t n = recv(fds[i].fd, buf, sizeof(buf), 0);
+                    if (n > 0)
+                        enqueue(fd_c, paths[i - 1].clnt, buf, size_t(n));
+                }
+        }
+    }
+
+  public:
+    relay() : fd_c(mk_sock(RELAY_PORT)), thr(&relay::run, this) {}
+
+    ~relay()
+    {
+        stop = true;
+        thr.join();
+        close(fd_c);
+        for (const auto & p : paths)
+            close(p.fd);
+    }
+};
+
+
+static relay * rly;
+static std::unordered_set<struct q_conn *> clnts;
+static uint64_t rx_bytes;
+static uint32_t rx_strms;
+
+
+static void on_event(const struct q_event * const ev,
+                     void * const arg __attribute__((unused)))
+{
+    // the server side reads whatever arrived
+    if (ev->type != q_ev_strm_readable || clnts.count(ev->c))
+        return;
+
+    struct w_iov_sq i = w_iov_sq_initializer(i);
+    q_read_stream(ev->s, &i, false);
+    rx_bytes += w_iov_sq_len(&i);
+    q_free(&i);
+    if (q_peer_closed_stream(ev->s)) {
+        rx_strms++;
+        q_free_stream(ev->s);
+    }
+}
+
+
+static uint64_t cpu_ns()
+{
+    struct timespec ts = {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return uint64_t(ts.tv_sec) * NS_PER_S + uint64_t(ts.tv_nsec);
+}
+
+
+static void BM_conn_matrix(benchmark::State & state)
+{
+    const auto n_conns = uint32_t(state.range(0));
+    const auto n_strms = uint32_t(state.range(1));
+    const auto len = uint64_t(state.range(2));
+    rly->loss_pm = uint32_t(state.range(3));
+    rly->reorder_pm = uint32_t(state.range(4));
+    rly->rtt_ns = uint64_t(state.range(5)) * NS_PER_MS;
+
+    struct sockaddr_in6 rip = {};
+    rip.sin6_family = AF_INET6;
+    rip.sin6_port = bswap16(RELAY_PORT);
+    rip.sin6_addr = in6addr_loopback;
+
+    // handshakes, through the relay
+    std::vector<struct q_conn *> cs;
+    std::vector<struct q_conn *> ss;
+    const uint64_t hshk_t = w_now();
+    for (uint32_t n = 0; n < n_conns; n++) {
+        struct q_conn * const c =
+            q_connect(w, reinterpret_cast<struct sockaddr *>(&rip), // NOLINT
+                      "localhost", nullptr, nullptr, true, nullptr, nullptr);
+        struct q_conn * const s = c ? q_accept(w, nullptr) : nullptr;
+        if (s == nullptr) {
+            state.SkipWithError("handshake failed");
+            return;
+        }
+        cs.push_back(c);
+        ss.push_back(s);
+        clnts.insert(c);
+    }
+    const double hshk_s = double(w_now() - hshk_t) / NS_PER_S;
+
+    q_set_event_cb(w, on_event, nullptr);
+    struct q_engine_stats st0 = {};
+    struct q_engine_stats st1 = {};
+    q_engine_stats(w, &st0);
+    uint64_t cpu = 0;
+    uint64_t bytes = 0;
+
+    for (auto _ : state) {
+        const uint64_t cpu0 = cpu_ns();
+        rx_bytes = rx_strms = 0;
+
+        std::vector<struct q_stream *> out;
+        for (auto * const c : cs)
+            for (uint32_t n = 0; n < n_strms; n++) {
+                struct q_stream * const s = q_rsv_stream(c, true);
+                if (s == nullptr)
+                    continue;
+                struct w_iov_sq o = w_iov_sq_initializer(o);
+                q_alloc(w, &o, c, q_conn_af(c), len);
+                q_write(s, &o, true);
+                out.push_back(s);
+            }
+
+        while (rx_strms < out.size())
+            q_process(w, q_next_timeout(w));
+        ensure(rx_bytes == len * out.size(), "mismatch %" PRIu64 " %" PRIu64,
+               len * out.size(), rx_bytes);
+        // count only the streams we could open
+        bytes += len * out.size();
+
+        for (auto * const s : out) {
+            struct w_iov_sq o = w_iov_sq_initializer(o);
+            q_stream_get_written(s, &o);
+            q_free(&o);
+            q_free_stream(s);
+        }
+        cpu += cpu_ns() - cpu0;
+    }
+
+    q_engine_stats(w, &st1);
+    q_set_event_cb(w, nullptr, nullptr);
+
+    state.SetBytesProcessed(int64_t(bytes));
+    state.counters["pkts/s"] = benchmark::Counter(
+        double(st1.pkts_out - st0.pkts_out), benchmark::Counter::kIsRate);
+    state.counters["cpu_ns/B"] = double(cpu) / double(bytes);
+    state.counters["hshk/s"] = n_conns / hshk_s;
+
+    for (size_t n = 0; n < cs.size(); n++) {
+        clnts.erase(cs[n]);
+        q_close(cs[n], 0, nullptr);
+        q_close(ss[n], 0, nullptr);
+    }
+}
+
+
+static void matrix(benchmark::internal::Benchmark * const b)
+{
+    b->ArgNames({"conns", "strms", "size", "loss", "reord", "rtt"});
+    for (const int64_t conns : {1, 8})
+        for (const int64_t strms : {1, 16})
+            for (const int64_t size : {16 * 1024, 1024 * 1024})
+                // loss and reordering rates are per mille, RTT is in ms
+                for (const auto & imp : {std::make_pair(0, 0),
+                                         std::make_pair(10, 0),
+                                         std::make_pair(0, 50)})
+                    for (const int64_t rtt : {0, 20})
+                        b->Args({conns, strms, size, imp.first, imp.second,
+                                 rtt});
+}
+
+
+BENCHMARK(BM_conn_matrix)
+    ->Apply(matrix)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+
 // BENCHMARK_MAIN()
 
 int main(int argc __attribute__((unused)), char ** argv)
@@ -140,8 +435,16 @@ int main(int argc __attribute__((unused)), char ** argv)
     const int cwd = open(".", O_CLOEXEC);
     ensure(cwd != -1, "cannot open");
     ensure(chdir(dirname(argv[0])) == 0, "cannot chdir");
+    // bench_conn-uring runs the same benchmark over the io_uring backend
     const struct q_conf conf = {nullptr, nullptr, "dummy.crt", "dummy.key",
-                                nullptr, nullptr, 1000000};
+                                nullptr, nullptr, 1000000,     false,
+                                false,   false,
+#ifdef BENCH_IO_URING
+                                true
+#else
+                                false
+#endif
+    };
     w = q_init("lo"
 #ifndef __linux__
                "0"
@@ -151,12 +454,13 @@ int main(int argc __attribute__((unused)), char ** argv)
     ensure(fchdir(cwd) == 0, "cannot fchdir");
 
     // bind server socket
-    q_bind(w, 0, 55555);
+    q_bind(w, 0, SERV_PORT);
+    rly = new relay;
 
     // connect to server
     struct sockaddr_in6 sip = {};
     sip.sin6_family = AF_INET6;
-    sip.sin6_port = bswap16(55555);
+    sip.sin6_port = bswap16(SERV_PORT);
     inet_pton(sip.sin6_family, "::1", &sip.sin6_addr);
     cc = q_connect(w, reinterpret_cast<struct sockaddr *>(&sip), // NOLINT
                    "localhost", nullptr, nullptr, true, nullptr, nullptr);
@@ -171,5 +475,6 @@ int main(int argc __attribute__((unused)), char ** argv)
     // close connections
     q_close(cc, 0, nullptr);
     q_close(sc, 0, nullptr);
+    delete rly;
     q_cleanup(w);
 }
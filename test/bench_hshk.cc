@@ -0,0 +1,174 @@
+// Copyright (c) 2014-2018, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <libgen.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+#include <quant/quant.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "quic.h" // IWYU pragma: keep
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#define TICKETS "bench_hshk.tickets"
+
+typedef enum { hs_full, hs_resumed, hs_0rtt, hs_rtry } hshk_t;
+
+
+static struct w_engine * init(const hshk_t mode)
+{
+    unlink(TICKETS);
+    const bool resume = mode == hs_resumed || mode == hs_0rtt;
+    const struct q_conf conf = {nullptr,
+                                resume ? TICKETS : nullptr,
+                                "dummy.crt",
+                                "dummy.key",
+                                nullptr,
+                                nullptr,
+                                10000,
+                                false,
+                                mode == hs_rtry};
+    struct w_engine * const w = q_init("lo"
+#ifndef __linux__
+                                       "0"
+#endif
+                                       ,
+                                       &conf);
+    q_bind(w, 0, 55555);
+    return w;
+}
+
+
+static bool hshk(struct w_engine * const w, const hshk_t mode)
+{
+    struct sockaddr_in6 sip = {};
+    sip.sin6_family = AF_INET6;
+    sip.sin6_port = bswap16(55555);
+    inet_pton(sip.sin6_family, "::1", &sip.sin6_addr);
+
+    // for 0-RTT, send a small request as early data
+    struct w_iov_sq o = w_iov_sq_initializer(o);
+    struct q_stream * es = nullptr;
+    if (mode == hs_0rtt)
+        q_alloc(w, &o, nullptr, AF_INET6, 64);
+
+    struct q_conn * const cc =
+        q_connect(w, reinterpret_cast<struct sockaddr *>(&sip), // NOLINT
+                  "localhost", mode == hs_0rtt ? &o : nullptr,
+                  mode == hs_0rtt ? &es : nullptr, true, nullptr, nullptr);
+    if (cc == nullptr)
+        return false;
+    struct q_conn * const sc = q_accept(w, nullptr);
+    if (sc == nullptr)
+        return false;
+
+    q_close(cc, 0, nullptr);
+    q_close(sc, 0, nullptr);
+    return true;
+}
+
+
+static void BM_hshk(benchmark::State & state)
+{
+    const auto mode = hshk_t(state.range(0));
+    struct w_engine * const w = init(mode);
+
+    // get a ticket to resume with
+    if ((mode == hs_resumed || mode == hs_0rtt) && hshk(w, hs_full) == false) {
+        state.SkipWithError("initial handshake failed");
+        q_cleanup(w);
+        return;
+    }
+
+#ifdef QUANT_PROFILE
+    memset(ped(w)->prof, 0, sizeof(ped(w)->prof));
+#endif
+
+    for (auto _ : state)
+        if (hshk(w, mode) == false) {
+            state.SkipWithError("handshake failed");
+            break;
+        }
+    state.SetItemsProcessed(state.iterations());
+
+#ifdef QUANT_PROFILE
+    // average time per handshake spent in the main connection setup stages
+    static const struct {
+        prof_stage_t s;
+        const char * name;
+    } stages[] = {{prof_tls_io, "tls_io"},
+                  {prof_init_tls, "init_tls"},
+                  {prof_new_conn, "new_conn"},
+                  {prof_free_conn, "free_conn"}};
+    for (const auto & st : stages)
+        state.counters[std::string(st.name) + "/" PROF_UNIT] =
+            double(ped(w)->prof[st.s].sum) / double(state.iterations());
+#endif
+
+    q_cleanup(w);
+    unlink(TICKETS);
+}
+
+
+BENCHMARK(BM_hshk)
+    ->ArgName("mode") // 0 = 1-RTT, 1 = resumed, 2 = 0-RTT, 3 = Retry
+    ->DenseRange(hs_full, hs_rtry)
+    ->Unit(benchmark::kMicrosecond);
+
+
+// BENCHMARK_MAIN()
+
+int main(int argc, char ** argv)
+{
+#ifndef NDEBUG
+    util_dlevel = WRN; // default to maximum compiled-in verbosity
+#endif
+
+    // the dummy certs (and the ticket store) live next to the binary
+    const int cwd = open(".", O_CLOEXEC);
+    ensure(cwd != -1, "cannot open");
+    ensure(chdir(dirname(argv[0])) == 0, "cannot chdir");
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+
+    ensure(fchdir(cwd) == 0, "cannot fchdir");
+    close(cwd);
+}
@@ -20,6 +20,15 @@ fi
 
 # For quant, call client and server with full path, so addr2line can find them
 
+# quant writes binary qlogs; turn them into the JSON the runner collects
+function convert_qlogs() {
+    if [ -n "$QLOGDIR" ]; then
+        for qlb in "$QLOGDIR"/*.qlb; do
+            [ -f "$qlb" ] && /usr/local/bin/qlog2json "$qlb" && rm -f "$qlb"
+        done
+    fi
+}
+
 if [ "$ROLE" == "client" ]; then
     CLIENT_ARGS="-i eth0 -w -q $QLOGDIR -l $SSLKEYLOGFILE -t 150 -x 50 \
         -e 0xff00001d $CLIENT_ARGS"
@@ -63,6 +72,7 @@ if [ "$ROLE" == "client" ]; then
         echo "XXX $ROLE DONE" | tee -i -a "/logs/$ROLE.log"
     fi
     sed 's,\x1B\[[0-9;]*[a-zA-Z],,g' "/logs/$ROLE.log" > "/logs/$ROLE.log.txt"
+    convert_qlogs
 
 elif [ "$ROLE" == "server" ]; then
     case "$TESTCASE" in
@@ -73,9 +83,14 @@ elif [ "$ROLE" == "server" ]; then
         ;;
     esac
 
+    # the server runs until the runner stops us, so convert on the way out
+    trap 'kill -INT $(jobs -p) 2> /dev/null; wait; convert_qlogs; exit' \
+        INT TERM
     /usr/local/bin/server $SERVER_ARGS -i eth0 -d /www -p 443 -p 4434 -t 0 \
         -x 50 -c /tls/dummy.crt -k /tls/dummy.key -q "$QLOGDIR" 2>&1 \
             | tee -i -a "/logs/$ROLE.log" \
             | sed -u 's,\x1B\[[0-9;]*[a-zA-Z],,g' \
-            | tee -i -a "/logs/$ROLE.log.txt"
+            | tee -i -a "/logs/$ROLE.log.txt" &
+    wait
+    convert_qlogs
 fi
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <quant/quant.h>
+
+#include "stats.h"
+
+int kPacketThreshold = 3;
+bool doPktThresh = true;
+int upkTimethresh = 9;
+int btkTimethresh = 8;
+
+
+int main(void)
+{
+    w_init_rand();
+
+    struct q_hist h;
+    memset(&h, 0, sizeof(h));
+    ensure(q_hist_quantile(&h, 0.5) == 0, "empty");
+
+    for (uint64_t v = 1; v <= 100000; v++)
+        hist_add(&h, v);
+    ensure(h.cnt == 100000 && h.min == 1 && h.max == 100000, "cnt/min/max");
+
+    // two significant bits, so within 25% of the exact quantile
+    static const double qs[] = {0.01, 0.5, 0.9, 0.99, 0.999};
+    for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); i++) {
+        const uint64_t exact = (uint64_t)(qs[i] * 100000);
+        const uint64_t got = q_hist_quantile(&h, qs[i]);
+        warn(DBG, "q%g: exact %" PRIu64 ", got %" PRIu64, qs[i], exact, got);
+        ensure(got >= exact && got <= exact + exact / 4, "q%g", qs[i]);
+    }
+    ensure(q_hist_quantile(&h, 1) == 100000, "max");
+
+    // values beyond the range end up in the last bucket
+    for (uint32_t i = 0; i < 1000; i++)
+        hist_add(&h, w_rand64());
+    ensure(h.bkt[Q_HIST_BKTS - 1] >= 900, "overflow bucket");
+
+    return 0;
+}
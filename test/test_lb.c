@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <quant/quant.h>
+#include <warpcore/warpcore.h>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wpadded"
+#pragma clang diagnostic ignored "-Wdocumentation"
+#pragma clang diagnostic ignored "-Wcast-qual"
+#pragma clang diagnostic ignored "-Wundef"
+#include "cid.h"
+#include "lb.h"
+#pragma clang diagnostic pop
+int kPacketThreshold = 3;
+bool doPktThresh = true;
+int upkTimethresh = 9;
+int btkTimethresh = 8;
+
+
+static void rand_fill(uint8_t * const buf, const size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        buf[i] = (uint8_t)w_rand_uniform32(UINT8_MAX + 1);
+}
+
+
+static void chk(struct q_lb_conf * const conf)
+{
+    for (uint32_t n = 0; n < 1000; n++) {
+        // q_lb_new() copies the conf, so each sid needs a new instance
+        rand_fill(conf->sid, conf->sid_len);
+        struct q_lb * const l = q_lb_new(conf);
+        ensure(l, "q_lb_new failed");
+        const uint8_t len = lb_cid_len(l);
+        ensure(len == 1 + conf->sid_len + conf->nonce_len, "len %u", len);
+        ensure(lb_is_plain(l) == (conf->key == 0), "wrong mode");
+
+        uint8_t cid[CID_LEN_MAX];
+        rand_fill(cid, sizeof(cid));
+        lb_enc(l, cid);
+        ensure(cid[0] >> 5 == conf->cr && (cid[0] & 0x1f) == len - 1,
+               "bad first octet 0x%02x", cid[0]);
+        ensure(lb_is_plain(l) == false ||
+                   memcmp(&cid[1], conf->sid, conf->sid_len) == 0,
+               "plaintext sid not in cid");
+
+        uint8_t sid[sizeof(conf->sid)];
+        ensure(q_lb_sid(l, cid, len, sid), "q_lb_sid failed");
+        ensure(memcmp(sid, conf->sid, conf->sid_len) == 0, "sid mismatch");
+
+        // the wrong length or config rotation codepoint is not ours
+        ensure(q_lb_sid(l, cid, len - 1, sid) == false, "accepted short cid");
+        cid[0] ^= 0x20;
+        ensure(q_lb_sid(l, cid, len, sid) == false, "accepted other cr");
+        q_lb_free(l);
+    }
+}
+
+
+int main(void)
+{
+    w_init_rand();
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+#endif
+
+    // plaintext
+    struct q_lb_conf conf = {.sid_len = 2, .nonce_len = 6, .cr = 1};
+    chk(&conf);
+
+    // single-pass AES-128
+    uint8_t key[16];
+    rand_fill(key, sizeof(key));
+    conf = (struct q_lb_conf){
+        .key = key, .sid_len = 4, .nonce_len = 12, .cr = 2};
+    chk(&conf);
+
+    // invalid configs are refused
+    conf = (struct q_lb_conf){.sid_len = 2, .nonce_len = 3};
+    ensure(q_lb_new(&conf) == 0, "accepted short plaintext nonce");
+    conf = (struct q_lb_conf){.key = key, .sid_len = 4, .nonce_len = 8};
+    ensure(q_lb_new(&conf) == 0, "accepted partial AES block");
+    conf = (struct q_lb_conf){.sid_len = 2, .nonce_len = 6, .cr = 7};
+    ensure(q_lb_new(&conf) == 0, "accepted unroutable cr");
+    conf = (struct q_lb_conf){.key = key, .sid_len = 16};
+    ensure(q_lb_new(&conf) == 0, "accepted oversized sid");
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2014-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <warpcore/warpcore.h>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wpadded"
+#pragma clang diagnostic ignored "-Wdocumentation"
+#pragma clang diagnostic ignored "-Wcast-qual"
+#pragma clang diagnostic ignored "-Wundef"
+#pragma clang diagnostic ignored "-Wimplicit-function-declaration"
+#include "marshall.h"
+#include "quic.h"
+#pragma clang diagnostic pop
+int kPacketThreshold = 3;
+bool doPktThresh = true;
+int upkTimethresh = 9;
+int btkTimethresh = 8;
+
+
+static void chk(const uint64_t val)
+{
+    uint8_t buf[16];
+    uint8_t * pos = buf;
+    encv(&pos, buf + sizeof(buf), val);
+    const uint8_t len = (uint8_t)(pos - buf);
+    ensure(len == varint_size(val), "len %u", len);
+
+    // with room for the fast path, and ending right after the varint
+    uint64_t dec;
+    const uint8_t * p = buf;
+    ensure(decv(&dec, &p, buf + sizeof(buf)), "decv failed");
+    ensure(dec == val && p == buf + len, "%" PRIu64 " != %" PRIu64, dec, val);
+    p = buf;
+    ensure(decv(&dec, &p, buf + len), "decv failed");
+    ensure(dec == val && p == buf + len, "%" PRIu64 " != %" PRIu64, dec, val);
+
+    // truncated varints must fail and leave pos alone
+    for (uint8_t t = 0; t < len; t++) {
+        p = buf;
+        ensure(decv(&dec, &p, buf + t) == false && p == buf, "len %u at %u",
+               len, t);
+    }
+}
+
+
+int main(void)
+{
+    w_init_rand();
+
+    // boundaries between the encoded lengths
+    static const uint64_t edges[] = {0x3f, 0x3fff, 0x3fffffff,
+                                     UINT64_C(0x3fffffffffffffff)};
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+        chk(edges[i]);
+        chk(edges[i] + (i < 3 ? 1 : 0));
+        chk(edges[i] >> 1);
+    }
+    chk(0);
+
+    // random values of all lengths, including all bits of the 8-byte case
+    for (uint32_t i = 0; i < 100000; i++) {
+        const uint64_t r = w_rand64() & UINT64_C(0x3fffffffffffffff);
+        chk(r >> (w_rand_uniform32(4) * 16));
+    }
+}
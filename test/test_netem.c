@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef NDEBUG
+#include <stdlib.h>
+#include <sys/param.h>
+#endif
+
+#include <quant/quant.h>
+int kPacketThreshold = 3;
+bool doPktThresh = true;
+int upkTimethresh = 9;
+int btkTimethresh = 8;
+
+
+#define LEN (1024 * 1024U)
+
+// ECDSA signatures and the random client CID length change the handshake by
+// a few dozen bytes between runs, each worth 800 ns at 10 Mbit/s
+#define XFER_TOL_NS (NS_PER_MS / 10)
+
+
+// transfer LEN bytes over a lossy 10 Mbit/s link with a 40 ms RTT, and return
+// the virtual time it took
+static uint64_t __attribute__((nonnull))
+xfer(const char * const dir, uint64_t * const pkts_out)
+{
+    const int cwd = open(".", O_CLOEXEC);
+    ensure(cwd != -1, "cannot open");
+    ensure(chdir(dir) == 0, "cannot chdir");
+    __extension__ const struct q_conf conf = {.tls_cert = "dummy.crt",
+                                              .tls_key = "dummy.key"};
+    struct w_engine * const w = q_init("lo"
+#ifndef __linux__
+                                       "0"
+#endif
+                                       ,
+                                       &conf);
+    ensure(fchdir(cwd) == 0, "cannot fchdir");
+    close(cwd);
+
+    const struct q_netem_conf nc = {.rate = 10000000,
+                                    .delay = 20 * NS_PER_MS,
+                                    .jitter = NS_PER_MS,
+                                    .seed = 4711,
+                                    .queue = 64 * 1024,
+                                    .loss = 10000,
+                                    .reorder = 1000};
+    q_netem_attach(w, &nc);
+    const uint64_t start = q_netem_now();
+
+    q_bind(w, 0, 55555);
+    struct sockaddr_in6 sip = {.sin6_family = AF_INET6,
+                               .sin6_port = bswap16(55555)};
+    inet_pton(AF_INET6, "::1", &sip.sin6_addr);
+    struct q_conn * const cc = q_connect(w, (const struct sockaddr *)&sip,
+                                         "localhost", 0, 0, true, 0, 0);
+    ensure(cc, "is zero");
+    struct q_conn * const sc = q_accept(w, 0);
+    ensure(sc, "is zero");
+
+    struct q_stream * const cs = q_rsv_stream(cc, true);
+    struct w_iov_sq o = w_iov_sq_initializer(o);
+    q_alloc(w, &o, cc, AF_INET6, LEN);
+    q_write(cs, &o, true);
+
+    // read the data
+    struct w_iov_sq i = w_iov_sq_initializer(i);
+    struct q_stream * ss = 0;
+    while (ss == 0) {
+        struct q_conn * c;
+        q_ready(w, 0, &c);
+        if (c == sc)
+            ss = q_read(sc, &i, true);
+    }
+    ensure(w_iov_sq_len(&i) == LEN, "got %" PRIu " of %u bytes",
+           w_iov_sq_len(&i), LEN);
+    const uint64_t t = q_netem_now() - start;
+
+    q_free(&i);
+    q_stream_get_written(cs, &o);
+    q_free(&o);
+    q_close_stream(ss);
+    q_close_stream(cs);
+    q_close(cc, 0, 0);
+    q_close(sc, 0, 0);
+
+    struct q_engine_stats st;
+    q_engine_stats(w, &st);
+    *pkts_out = st.pkts_out;
+    q_cleanup(w);
+    return t;
+}
+
+
+int main(int argc
+#ifdef NDEBUG
+         __attribute__((unused))
+#endif
+         ,
+         char * argv[])
+{
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+    int ch;
+    while ((ch = getopt(argc, argv, "v:")) != -1)
+        if (ch == 'v')
+            util_dlevel = MIN(DLEVEL, MAX(0, (short)strtoul(optarg, 0, 10)));
+#endif
+
+    // the same seed must give the same run, up to the handshake size
+    const char * const dir = dirname(argv[0]);
+    uint64_t pkts[2];
+    const uint64_t t0 = xfer(dir, &pkts[0]);
+    const uint64_t t1 = xfer(dir, &pkts[1]);
+    warn(NTE, "xfer took %" PRIu64 " and %" PRIu64 " ns, %" PRIu64
+         " and %" PRIu64 " pkts", t0, t1, pkts[0], pkts[1]);
+
+    // 1 MB at 10 Mbit/s takes at least 800 ms
+    ensure(t0 >= 800 * NS_PER_MS, "too fast for the link");
+    ensure((t0 > t1 ? t0 - t1 : t1 - t0) <= XFER_TOL_NS,
+           "virtual xfer times differ");
+}
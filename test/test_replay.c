@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <quant/quant.h>
+
+#include "replay.h"
+int kPacketThreshold = 3;
+bool doPktThresh = true;
+int upkTimethresh = 9;
+int btkTimethresh = 8;
+
+
+#define WINDOW 10
+
+// ticket IDs are random, and the filter hashes with their two halves
+#define ID1 UINT64_C(0x9e3779b97f4a7c15)
+#define ID2 UINT64_C(0xbf58476d1ce4e5b9)
+#define ID3 UINT64_C(0x94d049bb133111eb)
+
+
+int main(void)
+{
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+#endif
+    char path[] = "/tmp/test_replay.XXXXXX";
+    const int fd = mkstemp(path);
+    ensure(fd != -1, "mkstemp");
+    close(fd);
+
+    struct replay_filter * const rf = replay_new(path, WINDOW);
+    const time_t t = 1000 * WINDOW;
+
+    // a first sighting is new, a repeat is a replay
+    ensure(replay_seen(rf, ID1, t) == false, "new id seen");
+    ensure(replay_seen(rf, ID1, t), "repeated id not seen");
+    ensure(replay_seen(rf, ID2, t + WINDOW - 1) == false, "new id seen");
+
+    // remembered one bucket later, forgotten two buckets later
+    ensure(replay_seen(rf, ID1, t + WINDOW), "id forgotten after one bucket");
+    ensure(replay_seen(rf, ID3, t + WINDOW) == false, "new id seen");
+    ensure(replay_seen(rf, ID2, t + 2 * WINDOW) == false,
+           "id remembered after two buckets");
+
+    // an engine mapping the same file shares the filter
+    struct replay_filter * const other = replay_new(path, WINDOW);
+    ensure(replay_seen(other, ID3, t + 2 * WINDOW), "shared id not seen");
+
+    // after an idle gap, nothing stale is left
+    ensure(replay_seen(rf, ID2, t + 10 * WINDOW) == false,
+           "id remembered after idle gap");
+    ensure(replay_seen(other, ID2, t + 10 * WINDOW), "repeated id not seen");
+
+    replay_free(other);
+    replay_free(rf);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2020, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <quant/quant.h>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wpadded"
+#pragma clang diagnostic ignored "-Wdocumentation"
+#pragma clang diagnostic ignored "-Wcast-qual"
+#pragma clang diagnostic ignored "-Wundef"
+#include "conn.h"
+#include "ticket.h"
+#pragma clang diagnostic pop
+int kPacketThreshold = 3;
+bool doPktThresh = true;
+int upkTimethresh = 9;
+int btkTimethresh = 8;
+
+
+static char path[] = "/tmp/test_ticket.XXXXXX";
+
+
+static void save(const uint32_t i)
+{
+    char sni[16];
+    snprintf(sni, sizeof(sni), "sni%" PRIu32, i);
+    uint8_t tckt[64];
+    memset(tckt, (int)i, sizeof(tckt));
+    const struct transport_params tp = {.max_data = i};
+    tickets_save(sni, "alpn", &tp, i, tckt, sizeof(tckt) - i % sizeof(tckt));
+}
+
+
+static bool has(const uint32_t i)
+{
+    char sni[16];
+    char alpn[] = "alpn";
+    snprintf(sni, sizeof(sni), "sni%" PRIu32, i);
+    const struct tls_ticket * const t = tickets_find(sni, alpn);
+    if (t == 0)
+        return false;
+
+    ensure(t->vers == i && t->tp.max_data == i, "sni%" PRIu32 " mismatch", i);
+    ensure(t->ticket_len == 64 - i % 64, "sni%" PRIu32 " len %zu", i,
+           t->ticket_len);
+    for (size_t n = 0; n < t->ticket_len; n++)
+        ensure(t->ticket[n] == (uint8_t)i, "sni%" PRIu32 " byte %zu", i, n);
+    return true;
+}
+
+
+static size_t log_size(void)
+{
+    struct stat st;
+    ensure(stat(path, &st) == 0, "stat");
+    return (size_t)st.st_size;
+}
+
+
+int main(void)
+{
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+#endif
+    const int fd = mkstemp(path);
+    ensure(fd != -1, "mkstemp");
+    close(fd);
+    unlink(path);
+    const struct q_conf conf = {.ticket_store = path, .max_tickets = 4};
+
+    // round trip through the log
+    tickets_init(&conf);
+    for (uint32_t i = 0; i < 4; i++)
+        save(i);
+    tickets_free();
+    const size_t clean_size = log_size();
+    tickets_init(&conf);
+    for (uint32_t i = 0; i < 4; i++)
+        ensure(has(i), "sni%" PRIu32 " missing after replay", i);
+
+    // LRU: touching sni0 makes sni1 the next to go
+    ensure(has(0), "sni0 missing");
+    save(4);
+    ensure(has(1) == false, "sni1 not evicted");
+    ensure(has(0) && has(2) && has(3) && has(4), "wrong ticket evicted");
+    tickets_free();
+
+    // a torn tail loses only the last record, and is truncated away
+    const size_t size = log_size();
+    const int lfd = open(path, O_WRONLY | O_APPEND);
+    ensure(lfd != -1, "open");
+    const uint32_t torn[] = {64, 5};
+    ensure(write(lfd, torn, sizeof(torn)) == (ssize_t)sizeof(torn), "write");
+    close(lfd);
+    tickets_init(&conf);
+    ensure(has(0) && has(2) && has(3) && has(4), "lost tickets before tear");
+    ensure(log_size() <= size, "torn tail not removed");
+
+    // overwriting one peer's ticket keeps the log bounded by compaction
+    for (uint32_t n = 0; n < 1000; n++)
+        save(5);
+    ensure(has(5), "sni5 missing");
+    // clean_size holds four records, compaction leaves fewer than 80
+    ensure(log_size() < 20 * clean_size, "log not compacted, %zu bytes",
+           log_size());
+    tickets_free();
+    tickets_init(&conf);
+    ensure(has(5), "sni5 missing after compaction");
+    tickets_free();
+    unlink(path);
+
+    // export and import into a cache without a ticket store
+    tickets_init(&(struct q_conf){.max_tickets = 4});
+    save(6);
+    uint8_t buf[1024];
+    const size_t len = q_ticket_export("sni6", "alpn", buf, sizeof(buf));
+    ensure(len, "export failed");
+    ensure(q_ticket_export("sni7", "alpn", buf, sizeof(buf)) == 0,
+           "exported unknown ticket");
+    ensure(q_ticket_export("sni6", "alpn", buf, len - 1) == 0,
+           "exported into a short buffer");
+    tickets_free();
+
+    tickets_init(&(struct q_conf){.max_tickets = 4});
+    ensure(has(6) == false, "sni6 survived without a store");
+    ensure(q_ticket_import(buf, len - 1) == false, "imported truncated");
+    buf[0] ^= 0xff;
+    ensure(q_ticket_import(buf, len) == false, "imported foreign build");
+    buf[0] ^= 0xff;
+    ensure(q_ticket_import(buf, len), "import failed");
+    ensure(has(6), "sni6 missing after import");
+    tickets_free();
+
+    return 0;
+}